@@ -7,23 +7,44 @@
 //
 // link flags: -nostartfiles --gc-sections -mmcu=attiny13a -mrelax
 //
+// attiny25/45/85 with USI: -mmcu=attiny85 -DOLED1306_USI (display wired to the USI pins, see below)
+// faster clock: -DCLOCK_PROFILE=0 (9.6MHz) or 1 (4.8MHz), the game keeps its speed (see FRAME_TIME)
+//
 
+#ifdef CLOCK_PROFILE
+#define F_CPU (HAL_CLOCK_OSC >> CLOCK_PROFILE)
+#else
 // default attiny13a fuses = 1MHz
 #define F_CPU 1000000L
+#endif
 
-#include <avr/io.h>
-#include <util/delay.h>
+#include "hal.h"
+#include "font.h"
+#include "cost.h"
 
 // 4-wire connection to oled1306 display
 //
+#ifdef OLED1306_USI // attiny25/45/85 (-DOLED1306_USI): USI three-wire mode shifts data out of DO clocked by USCK
+#define D_DIN PORTB1 // D1 (DO)
+#define D_CLK PORTB2 // D0 (USCK)
+#define D_DC  PORTB3
+#define D_RES PORTB4
+#else
 #define D_DIN PORTB3 // D1
 #define D_CLK PORTB4 // D0
 #define D_DC  PORTB2
 #define D_RES PORTB1
+#endif
 
 #define OLED1306_PORT_HI(p) (PORTB |= (1 << (p)))
 #define OLED1306_PORT_LO(p) (PORTB &= ~(1 << (p)))
 
+#ifdef OLED1306_USI
+#define OLED1306_CLK_PULSE() (USICR = (1 << USIWM0) | (1 << USITC), USICR = (1 << USIWM0) | (1 << USITC)) // USIDR isn't shifted
+#else
+#define OLED1306_CLK_PULSE() (OLED1306_PORT_HI(D_CLK), OLED1306_PORT_LO(D_CLK))
+#endif
+
 // magic
 //
 template <uint8_t... Chars> struct chars {
@@ -35,6 +56,8 @@ private:
     }
         
 public:
+    static constexpr uint8_t size = sizeof...(Chars); // bytes sent by apply, see cost.h
+
     template <void (*f)(uint8_t)> static void apply() {
         _apply<f, Chars...>();
     }
@@ -158,7 +181,7 @@ using startText = chars<
     0b11111110
 >;
 
-const uint8_t imgdat[] = {
+HAL_PAGE_LOCAL const uint8_t imgdat[] = {
     0b00100000, // enemy fall animation
     0b00010000,
     0b11110100,
@@ -194,17 +217,6 @@ const uint8_t imgdat[] = {
     0b11000000,
     0b01000000,
     0b10000000,
-    
-    0x1F, 0x11, 0x1F, // '0'  48
-    0x12, 0x1F, 0x10, // '1'  49
-    0x1D, 0x15, 0x17, // '2'  50
-    0x11, 0x15, 0x1F, // '3'  51
-    0x07, 0x04, 0x1F, // '4'  52
-    0x17, 0x15, 0x1D, // '5'  53
-    0x1F, 0x15, 0x1D, // '6'  54
-    0x01, 0x1D, 0x03, // '7'  55
-    0x1F, 0x15, 0x1F, // '8'  56
-    0x17, 0x15, 0x1F, // '9'  57
 };
 
 union compreg {
@@ -216,11 +228,10 @@ union compreg {
 };
 
 // does not count as assembler using :)
-register compreg anim_ptr asm ("r2");
-register uint8_t anim_offset asm ("r4");
-register uint8_t bg_draw_offset asm ("r6");
-register uint8_t range_arg_0 asm ("r16");
-register uint8_t range_arg_1 asm ("r17");
+HAL_REGISTER(compreg, anim_ptr, "r2"); // anim_ptr.lo++ walks imgdat
+HAL_REGISTER(uint8_t, bg_draw_offset, "r6");
+HAL_REGISTER(uint8_t, range_arg_0, "r16");
+HAL_REGISTER(uint8_t, range_arg_1, "r17");
 
 static constexpr uint8_t DISPLAY_MAX_X_COORD = 127;
 static constexpr uint8_t BACKGROUND_A_VERTICAL_OFFSET = 2;
@@ -230,7 +241,36 @@ static constexpr uint8_t SCORE_HORIZONTAL_OFFSET = 120;
 static constexpr uint8_t PLAYER_VERTICAL_OFFSET = 4;
 static constexpr uint8_t PLAYER_HORIZONTAL_OFFSET = 43;
 static constexpr uint8_t ENEMY_FIGHT_OFFSET = 50;
-
+static constexpr uint8_t LIFE_MAX = 10; // a column of the life bar each
+static constexpr uint8_t FIGHTERS_CLEAR_WIDTH = 15;
+static constexpr uint8_t BACKGROUND_A_STREETS = 2; // the street of background A is drawn twice across the page
+static constexpr uint8_t GROUND_RUN_0 = 19; // empty ground between the buildings of a street
+static constexpr uint8_t GROUND_RUN_1 = 8;
+static constexpr uint8_t GROUND_RUN_2 = 21;
+static constexpr uint8_t GROUND_RUN_3 = 18;
+
+#ifdef OLED1306_USI
+// every USICR write toggles USCK, the second one of a pair also shifts USIDR: 2 cycles per bit instead of ~13
+//
+static constexpr uint16_t SEND_CYCLES = 28; // per byte with call and D/C
+static constexpr uint16_t REPEAT_CYCLES = 20; // per byte of send_repeat with 0x00 or 0xFF
+void send_value(uint8_t value) {
+    const uint8_t clk_rise = (1 << USIWM0) | (1 << USITC);
+    const uint8_t clk_fall = (1 << USIWM0) | (1 << USITC) | (1 << USICLK);
+
+    USIDR = value;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+}
+#else
+static constexpr uint16_t SEND_CYCLES = 115; // per byte with call and D/C, ~13 per bit
+static constexpr uint16_t REPEAT_CYCLES = 36; // per byte of send_repeat with 0x00 or 0xFF
 void send_value(uint8_t value) {
     OLED1306_PORT_LO(D_CLK);
     
@@ -247,6 +287,7 @@ void send_value(uint8_t value) {
         OLED1306_PORT_LO(D_CLK);
     }
 }
+#endif
 
 void __attribute__ ((noinline)) send_command(uint8_t cmd) {
     OLED1306_PORT_LO(D_DC);
@@ -258,6 +299,38 @@ void __attribute__ ((noinline)) send_data(uint8_t dat) {
     send_value(dat);
 }
 
+// run of one data byte: D/C is set once, for 0x00 and 0xFF the data line doesn't change either and a byte is 8 clock
+// pulses only (bit-bang: ~36 cycles per byte instead of ~115 for send_data in a loop, other values ~105)
+//
+void send_repeat(uint8_t value, uint16_t count) {
+    OLED1306_PORT_HI(D_DC);
+
+    if (uint8_t(value + 1) > 1) { // not uniform bits
+        do {
+            send_value(value);
+        }
+        while (--count);
+
+        return;
+    }
+
+#ifdef OLED1306_USI
+    USIDR = value;
+#else
+    OLED1306_PORT_LO(D_DIN);
+
+    if (value) {
+        OLED1306_PORT_HI(D_DIN);
+    }
+#endif
+
+    do {
+        OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE();
+        OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE();
+    }
+    while (--count);
+}
+
 static void init_display() {
     OLED1306_PORT_HI(D_CLK);
     OLED1306_PORT_LO(D_RES);
@@ -269,6 +342,10 @@ static void init_display() {
     while(--i);
     
     OLED1306_PORT_HI(D_RES);
+
+#ifdef OLED1306_USI
+    OLED1306_PORT_LO(D_CLK); // USCK idles low, strobes only toggle it
+#endif
     
     chars<0xAE, 0xD5, 0x80, 0xA8, 0x3f, 0x20, 0x00, 0xAF>::apply<send_command>();
 }
@@ -295,6 +372,30 @@ void set_page_range_r_imp() {
     range_arg_1 = e; \
     set_page_range_r_imp(); } while(0);
 
+// the game screen is drawn in page addressing: 0xB0 + page and two column nibbles instead of 3 + 3 bytes of windows,
+// the column runs on across a page change like in a full width window. fall() wraps in a narrow window, it's horizontal
+//
+static constexpr uint8_t ADDRESSING_HORIZONTAL = 0x00;
+static constexpr uint8_t ADDRESSING_PAGE = 0x02;
+
+void set_addressing(uint8_t mode) {
+    send_command(0x20);
+    send_command(mode);
+}
+
+void set_column_r_imp() {
+    send_command(range_arg_1 & 0x0F);
+    send_command(0x10 | (range_arg_1 >> 4));
+}
+
+#define set_column_r(c) do {\
+    range_arg_1 = c; \
+    set_column_r_imp(); } while(0);
+
+#define set_position_r(p, c) do {\
+    send_command(0xB0 | (p)); \
+    set_column_r(c); } while(0);
+
 void delay(uint8_t ms_x10) {
     do {
         _delay_ms(10);
@@ -302,6 +403,48 @@ void delay(uint8_t ms_x10) {
     while (--ms_x10);
 }
 
+// frames (see cost.h): every frame draws the life bar, the score, background A (counted as sent even where the scroll
+// skips it), background B and the fighters. The worst one is the first of an enemy, which sets the addressing mode
+// first. A frame that ends in fall() is the last one of its fight and isn't counted
+//
+namespace frame_cost {
+    constexpr cost::Cost send(uint32_t count) {
+        return cost::bytes(count, SEND_CYCLES);
+    }
+
+    static constexpr uint16_t STREET_BYTES = // in the order of the background loop in main
+        building2::size + building0::size + building0::size + building1::size + GROUND_RUN_0 +
+        building2::size + building0::size + building2::size + building2::size + GROUND_RUN_1 +
+        building1::size + building2::size + GROUND_RUN_2 +
+        building0::size + building1::size + GROUND_RUN_3;
+
+    constexpr cost::Cost addressing = send(2); // set_addressing
+    constexpr cost::Cost position = send(3); // set_position_r
+    constexpr cost::Cost column = send(2); // set_column_r
+
+    constexpr cost::Cost top = position + send(LIFE_MAX) + column + send(2 * font::DIGIT_WIDTH);
+    constexpr cost::Cost background = position + send(BACKGROUND_A_STREETS * STREET_BYTES) + send(1) +
+        send(DISPLAY_MAX_X_COORD + 1); // 0b10000000 isn't a uniform byte, send_repeat sends it with send_value
+    constexpr cost::Cost fighters = position + send(FIGHTERS_CLEAR_WIDTH) + column + send(cost::widest(
+        fighter_stay::size, fighter_walk0::size, fighter_walk1::size, fighter_punch::size, fighter_hitted::size)) +
+        column + send(cost::widest(enemy_stay::size, enemy_punch::size, enemy_hitted::size));
+
+    constexpr cost::Cost typical = top + background + fighters;
+    constexpr cost::Cost worst = addressing + typical;
+}
+
+// pause of a frame in delay() units: 10ms at 1MHz, a faster clock adds the drawing time of a typical frame it saves so
+// the game keeps its speed
+//
+static constexpr uint8_t FRAME_TIME =
+    (10 + frame_cost::typical.cycles / 1000 - frame_cost::typical.cycles / (F_CPU / 1000) + 5) / 10;
+
+// every frame draws the same steps, so this only bounds what the first frame of an enemy adds: at 1MHz with the
+// bit-banged display it draws in 51.5ms of the 112.6ms budget
+//
+static_assert(frame_cost::worst.cycles <= cost::budget(FRAME_TIME * 10, frame_cost::typical, F_CPU),
+    "Worst frame doesn't fit the drawing budget");
+
 void drawFighter(uint8_t counter) {
     uint8_t frame = counter & 0b110;
             
@@ -358,22 +501,17 @@ void fall() {
     delay(40);    
 }
 
-void draw_score() {
-    range_arg_0 = 3;
-    anim_ptr.ptr = imgdat + 30 + anim_offset;
-        
-    do {
-        send_data(*anim_ptr.ptr);
-        anim_ptr.lo++;
-    }
-    while(--range_arg_0);
-
-    send_data(0);
+void fall_window(uint8_t x) { // horizontal addressing, fall() wraps in a 5 column window on the fighters' page
+    set_addressing(ADDRESSING_HORIZONTAL);
+    set_page_range_r(PLAYER_VERTICAL_OFFSET, PLAYER_VERTICAL_OFFSET);
+    set_coord_range_r(x, x + 4);
 }
 
 // Compiler will generate code that fill memory (22 bytes)
 void main() __attribute__((naked, section(".init9")));
 void main() {
+    HAL_CLOCK_INIT();
+
     DDRB  = 0b00011110;
     PORTB = 0b00000001;
 
@@ -384,14 +522,7 @@ void main() {
     range_arg_1 = DISPLAY_MAX_X_COORD;
     set_coord_range_r_imp();    
 
-    { // clear display 64x128 (1-bit per pixel)
-        uint16_t i = 8 * 128;
-    
-        do {
-            send_data(0x00);
-        }
-        while (--i);    
-    }    
+    send_repeat(0x00, 8 * 128); // clear display 64x128 (1-bit per pixel)
 
     range_arg_0 = BACKGROUND_A_VERTICAL_OFFSET;
     set_page_range_r_imp();
@@ -404,21 +535,15 @@ void main() {
     // wait for button press
     while((PINB & 0x1) == 0);
             
-    int8_t life = 10;
-    uint8_t rnd;
-    
-    union {
-        uint16_t word;
-        struct {
-            uint8_t lo;
-            uint8_t hi;
-        };
-    } score;
+    int8_t life = LIFE_MAX;
+    uint8_t rnd HAL_NOINIT;
     
-    score.word = 0;
+    uint8_t score = 0; // packed BCD
     
     // cycle per enemy
     while (true) {        
+        set_addressing(ADDRESSING_PAGE);
+
         uint8_t enemy_offset = 100;
         uint8_t enemy_punch_counter = 0;
         uint8_t player_punch_counter = 0;
@@ -427,9 +552,7 @@ void main() {
                 
         // draw cycle
         while (true) {       
-            set_page_range_r(0, 0);
-            range_arg_1 = DISPLAY_MAX_X_COORD;
-            set_coord_range_r_imp(); 
+            set_position_r(0, 0);
 
             // top-left life bar
             {
@@ -437,68 +560,63 @@ void main() {
                 do {                    
                     send_data(i >= life ? 0x19 : 0x1F);
                 }
-                while(++i < 10);
+                while(++i < LIFE_MAX);
             }
 
-            range_arg_0 = SCORE_HORIZONTAL_OFFSET;
-            set_coord_range_r_imp();
+            set_column_r(SCORE_HORIZONTAL_OFFSET);
 
             // top-right score
-            anim_offset = score.hi;
-            draw_score();
-            anim_offset = score.lo;
-            draw_score();
+            font::draw_number<send_data>(score);
 
-            set_page_range_r(BACKGROUND_A_VERTICAL_OFFSET, BACKGROUND_A_VERTICAL_OFFSET); 
-            set_coord_range_r(0, DISPLAY_MAX_X_COORD);
+            set_position_r(BACKGROUND_A_VERTICAL_OFFSET, 0);
             
             range_arg_0 = 0;
             
             // background image
             {
-                uint8_t i = 2;
+                uint8_t i = BACKGROUND_A_STREETS;
                 
                 do {
                     building2::apply_noinline<send_data_c>();
                     building0::apply_noinline<send_data_c>();
                     building0::apply_noinline<send_data_c>();
                     building1::apply_noinline<send_data_c>();
-                    range_arg_1 = 19;
+                    range_arg_1 = GROUND_RUN_0;
                     fill_ground();
                     building2::apply_noinline<send_data_c>();
                     building0::apply_noinline<send_data_c>();
                     building2::apply_noinline<send_data_c>();
                     building2::apply_noinline<send_data_c>();
-                    range_arg_1 = 8;
+                    range_arg_1 = GROUND_RUN_1;
                     fill_ground();
                     building1::apply_noinline<send_data_c>();
                     building2::apply_noinline<send_data_c>();
-                    range_arg_1 = 21;
+                    range_arg_1 = GROUND_RUN_2;
                     fill_ground();
                     building0::apply_noinline<send_data_c>();
                     building1::apply_noinline<send_data_c>();
-                    range_arg_1 = 18;
+                    range_arg_1 = GROUND_RUN_3;
                     fill_ground();
                 }
                 while(--i);
             }      
             
-            set_page_range_r(BACKGROUND_B_VERTICAL_OFFSET, BACKGROUND_B_VERTICAL_OFFSET);     
+            send_command(0xB0 | BACKGROUND_B_VERTICAL_OFFSET); // the column runs on from background A
 
-            range_arg_1 = range_arg_0 = 128;            
-            fill_ground();
+            send_repeat(0b10000000, DISPLAY_MAX_X_COORD + 1); // whole page, no scroll offset
               
-            set_page_range_r(PLAYER_VERTICAL_OFFSET, PLAYER_VERTICAL_OFFSET);            
-            set_coord_range_r(PLAYER_HORIZONTAL_OFFSET, PLAYER_HORIZONTAL_OFFSET + 14);
+            set_position_r(PLAYER_VERTICAL_OFFSET, PLAYER_HORIZONTAL_OFFSET);
             
             // clear place for player and enemy
             {
-                uint8_t i = 15;
+                uint8_t i = FIGHTERS_CLEAR_WIDTH;
                 do {
                     send_data(0);
                 }
                 while (--i);
             }
+
+            set_column_r(PLAYER_HORIZONTAL_OFFSET);
             
             if (enemy_offset > ENEMY_FIGHT_OFFSET) {
                 ++player_walk_counter;
@@ -507,7 +625,7 @@ void main() {
                     --enemy_offset;
     
                     if ((player_walk_counter & 0b110) == 0b110) {
-                        bg_draw_offset = (++bg_draw_offset) & 0x7f;
+                        bg_draw_offset = (bg_draw_offset + 1) & 0x7f;
                     }
                 }
             }
@@ -524,22 +642,13 @@ void main() {
                         }
                         else {
                             fighter_kick::apply<send_data>();
-                            set_coord_range_r(ENEMY_FIGHT_OFFSET, ENEMY_FIGHT_OFFSET + 4);
+                            fall_window(ENEMY_FIGHT_OFFSET);
                             
                             // enemy fall
                             range_arg_0 = 0;
                             fall();
                             
-                            score.lo += 3;
-                            if (score.lo == 30 ) {
-                                score.lo = 0;
-                                score.hi += 3;
-
-                                if (score.hi == 30 ) {
-                                    score.lo = 0;
-                                    score.hi = 0;
-                                }
-                            }                          
+                            font::bcd_inc(score);
                             
                             break;
                         }
@@ -570,16 +679,12 @@ void main() {
                 drawFighter(player_walk_counter);
             }
             
-            range_arg_1 = DISPLAY_MAX_X_COORD;
-            
             if (enemy_punch_counter > 2) {
-                range_arg_0 = ENEMY_FIGHT_OFFSET - 1;
-                set_coord_range_r_imp();
+                set_column_r(ENEMY_FIGHT_OFFSET - 1);
                 enemy_punch::apply<send_data>();
             }
             else {
-                range_arg_0 = enemy_offset;
-                set_coord_range_r_imp();
+                set_column_r(enemy_offset);
                 
                 if (player_punch_counter) {
                     player_punch_counter--;
@@ -590,17 +695,18 @@ void main() {
                     
                     // player fall
                     if (life <= 0) {
-                        set_coord_range_r(PLAYER_HORIZONTAL_OFFSET, PLAYER_HORIZONTAL_OFFSET + 4);
+                        fall_window(PLAYER_HORIZONTAL_OFFSET);
                         
                         range_arg_0 = 15;
                         fall();
                         
+                        HAL_GAME_OVER((score >> 4) * 10 + (score & 0xF));
                         goto game_start;
                     }
                 }
             }
             
-            delay(1);
+            delay(FRAME_TIME);
         }
     }
 }
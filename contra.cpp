@@ -18,7 +18,7 @@ Wiring:
                    [   SCK --|     |--
    ASP Programmer  [  MOSI --|     |-- DISPLAY SDA (DIN)
                    [   RST --|     |-- DISPLAY SCL (CLK)
-               GND -- BTN0 --|     |--
+               GND -- BTN0 --|     |-- (PHASE)
                GND -- BTN1 --|     |-- DISPLAY D/C (DCS)
                GND -- BTN2 --|     |-- DISPLAY RST
                              +-----+
@@ -26,13 +26,14 @@ Wiring:
 BTN0 - LEFT
 BTN1 - RIGHT
 BTN2 - ACTION
+PHASE - phase marks of the instrumentation build (-DPHASE_TRACE), see PHASE_BIT
 -------------------------------------------------------------------------------
 */
 
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 
 #include <stddef.h>
-#include <avr/io.h>
+#include "hal.h"
 
 struct pair {
     uint8_t lo;
@@ -40,7 +41,7 @@ struct pair {
 };
 
 struct port {
-    volatile uint8_t &port;
+    decltype(PORTB) port;
     uint8_t bit;
 };
 
@@ -56,6 +57,11 @@ static const port port_clk = { PORTB, 1 };
 static const port port_res = { PORTA, 6 };
 static const port port_dcs = { PORTA, 7 };
 
+// phase marks go to the spare PB0 (already an output), tools/phase_report.py decodes them.
+// Phases: 1 shots, 2 player state machine, 3 map redraw, 4 enemies, 5 delay, 6 restart (level over, title screen)
+#define PHASE_PORT PORTB
+#define PHASE_BIT 0
+
 #define set_bit_hi(p) (p.port |= (1 << p.bit));
 #define set_bit_lo(p) (p.port &= ~(1 << p.bit));
 
@@ -69,11 +75,27 @@ static const uint8_t GAME_UNIVERSAL_CONST = 6;
 static const uint8_t GAME_SCREEN_WIDTH = 128;
 static const uint8_t GAME_MAP_BYTE_SIZE = 64;
 static const uint8_t GAME_MAP_BLOCK_WIDTH = 16;
+static const uint8_t GAME_TITLE_BLOCK = 27; // title is 2 blocks at page 3, column 48 of the title screen
+// three levels 12 blocks wide with a camera that follows the player (-DWIDE_LEVELS). They don't fit the 1KB of flash
+// next to the game, the default build has the single level of the screen's width and neither the table nor the camera
+//
+#ifdef WIDE_LEVELS
+static const uint8_t GAME_MAP_WIDTH = 12; // blocks in a level row, the screen shows GAME_VIEW_BLOCKS of them
+static const uint8_t GAME_LEVELS = 3;
+#else
+static const uint8_t GAME_MAP_WIDTH = 8;
+static const uint8_t GAME_LEVELS = 1;
+#endif
+static const uint8_t GAME_VIEW_BLOCKS = GAME_SCREEN_WIDTH / GAME_MAP_BLOCK_WIDTH;
+static const uint8_t GAME_VIEW_PAGES = 8;
+static const uint8_t GAME_CAMERA_MARGIN = 2 * GAME_MAP_BLOCK_WIDTH; // camera moves when the player comes that close to the screen edge
 static const uint8_t GAME_MAP_TOP_STAGE = 2;
 static const uint8_t GAME_MAP_STAGE_DIFF = 2;
 static const uint8_t GAME_HP_COORD = 12;
+static const uint8_t GAME_HUD_BLOCKS = 2; // hp at the start of page 0, these blocks don't follow the camera
+static const uint8_t GAME_REDRAW_PAGES = 2; // pages of the view redrawn per frame after a camera step
 static const uint8_t GAME_DIST_TO_ATTACK = 60;
-static const uint8_t GAME_SHOTS_MAX = 6;
+static const uint8_t GAME_SHOTS_MAX = 8; // directions are bits of one byte, so 8 at most
 static const uint8_t GAME_OBJECT_INACTIVE = 255;
 static const uint8_t GAME_CHAR_WIDTH = 5;
 static const uint8_t GAME_CHAR_HALF = 3;
@@ -165,9 +187,31 @@ template<> const uint8_t indexof<0b00110000> = 12;
 template<> const uint8_t indexof<0b01000000> = 13;
 template<> const uint8_t indexof<0b00100000> = 14;
 
+// map blocks are stored as indices of NormalData::map_blocks ('X' blocks cause player to stop)
+//
+enum MapBlock : uint8_t {
+    EE,  // empty, the most popular
+    EX,
+    LE,  // ladder going down from this row
+    LEX, // ladder bottom
+    FN,
+    HP,
+    HB,
+    EMX,
+    HRX,
+    HLX,
+};
+
+// every even row of the level is here (4 rows of GAME_MAP_WIDTH blocks). Odd rows are evaluated
+// Trailing EE is never read: Worker drops the bits of the last symbol that don't fit in its output byte
+//
+template<uint8_t... In> struct Level : compress::Worker<CompressingStrategy, In..., EE>::template Result<> {
+    static_assert(sizeof...(In) == 4 * GAME_MAP_WIDTH, "Level size mismatch");
+};
+
 // const data in the program memory (compressed)
-// data size: 192 bytes
-// compressed size: 61 bytes
+// data size: 192 bytes of graphics, 32 blocks of the level
+// compressed size: 61 bytes, 14 bytes (19 bytes per level with -DWIDE_LEVELS)
 //
 const struct TightData {
     Encoded<
@@ -385,6 +429,40 @@ const struct TightData {
         0b00000000
     >
     title;
+
+#ifdef WIDE_LEVELS
+    Level<
+        HP,  HB,  EE,  EE,  EE,  EE,  EE,  FN,  EE,  EE,  EE,  EE,
+        EMX, LE,  EE,  HRX, HLX, EE,  EE,  LEX, EE,  HRX, HLX, EX,
+        EX,  LEX, EE,  EE,  HRX, HLX, LE,  EE,  EE,  EE,  EE,  EX,
+        EX,  EE,  HRX, HLX, EE,  EE,  LEX, EE,  HRX, HLX, EE,  EMX
+    >
+    level_0;
+
+    Level<
+        HP,  HB,  EE,  EE,  FN,  EE,  EE,  EE,  EE,  EE,  EE,  EE,
+        EX,  LE,  HRX, HLX, LEX, EE,  EE,  EE,  HRX, HLX, EE,  EMX,
+        EX,  LEX, EE,  EE,  HRX, HLX, LE,  EE,  EE,  EE,  EE,  EX,
+        EX,  EE,  HRX, HLX, EE,  EE,  LEX, EE,  EE,  HRX, HLX, EMX
+    >
+    level_1;
+
+    Level<
+        HP,  HB,  FN,  EE,  EE,  EE,  EE,  EE,  EE,  EE,  EE,  EE,
+        EMX, EE,  LEX, EE,  HRX, HLX, LE,  EE,  HRX, HLX, EE,  EX,
+        EX,  LE,  EE,  HRX, HLX, EE,  LEX, EE,  EE,  EE,  EE,  EX,
+        EX,  LEX, EE,  EE,  HRX, HLX, EE,  EE,  EE,  HRX, HLX, EMX
+    >
+    level_2;
+#else
+    Level<
+        HP,  HB,  EE,  EE,  EE,  EE,  EE,  FN,
+        EMX, LE,  EE,  HRX, HLX, EE,  EE,  LEX,
+        EX,  LEX, EE,  EE,  HRX, HLX, LE,  EX,
+        EX,  EE,  HRX, HLX, EE,  EE,  LEX, EMX
+    >
+    level_0;
+#endif
 }
 tight __attribute__((used, section(".init2")));
 
@@ -522,12 +600,16 @@ const struct NormalData {
         0b00000010,
     };
 
-    uint8_t level_0[GAME_MAP_BYTE_SIZE / 2] = { // Every even row is here. Odd rows are evaluated
-        OFT(tight.hp.m), OFT(tight.hb.m), EMPTY_BLOCK_OFT, EMPTY_BLOCK_OFT, EMPTY_BLOCK_OFT, EMPTY_BLOCK_OFT, EMPTY_BLOCK_OFT, OFT(tight.fn.m),
-        OFX(tight.em.m), OFT(tight.le.m), EMPTY_BLOCK_OFT, OFX(tight.hr.m), OFX(tight.hl.m), EMPTY_BLOCK_OFT, EMPTY_BLOCK_OFT, OFX(tight.le.m),
-        EMPTY_BLOCK_OFX, OFX(tight.le.m), EMPTY_BLOCK_OFT, EMPTY_BLOCK_OFT, OFX(tight.hr.m), OFX(tight.hl.m), OFT(tight.le.m), EMPTY_BLOCK_OFX,
-        EMPTY_BLOCK_OFX, EMPTY_BLOCK_OFT, OFX(tight.hr.m), OFX(tight.hl.m), EMPTY_BLOCK_OFT, EMPTY_BLOCK_OFT, OFX(tight.le.m), OFX(tight.em.m),
+    uint8_t map_blocks[HLX + 1] = { // alphabet of the levels, in order of MapBlock
+        EMPTY_BLOCK_OFT, EMPTY_BLOCK_OFX, OFT(tight.le.m), OFX(tight.le.m), OFT(tight.fn.m),
+        OFT(tight.hp.m), OFT(tight.hb.m), OFX(tight.em.m), OFX(tight.hr.m), OFX(tight.hl.m),
+    };
+
+#ifdef WIDE_LEVELS
+    uint8_t levels[GAME_LEVELS] = { // level offsets, any level may compress to any size
+        OFT(tight.level_0.m), OFT(tight.level_1.m), OFT(tight.level_2.m),
     };
+#endif
 }
 normal __attribute__((used, section(".init3")));
 
@@ -535,20 +617,27 @@ normal __attribute__((used, section(".init3")));
 #define OFN(x) (uint8_t(reinterpret_cast<const uint8_t *>(x) - reinterpret_cast<const uint8_t *>(&normal)) + PGM_DATA_OFFSET + sizeof(tight) - 1) // see spi::send_dat_sequence for details
 
 // Enemies placed to .init1 so enemy description offset is equal to it's vertical position (optimization)
+// Horizontal positions are in the level coordinates, the camera offset is subtracted while drawing
 //
 struct Enemy {
     uint8_t h_position;
     uint8_t direction;
 }
 enemies[GAME_ENEMIES_MAX] __attribute__((used, section(".init1"))) = {
+#ifdef WIDE_LEVELS
+    {149, SequenceDirection::BACKWARD},
+    {37, SequenceDirection::FORWARD},
+    {133, SequenceDirection::BACKWARD},
+#else
     {101, SequenceDirection::BACKWARD},
     {37, SequenceDirection::FORWARD},
     {85, SequenceDirection::BACKWARD},
+#endif
 };
 
 // dynamic SRAM data
 //
-struct {
+HAL_STATE struct {
     uint8_t time_counter;
     uint8_t draw_x_coord;
     uint8_t attack_counter;
@@ -562,15 +651,17 @@ struct {
     uint8_t enemy_state;
     uint8_t enemy_img_offset;
     uint8_t shots_coords[GAME_SHOTS_MAX];
-    uint8_t shots_dirs[GAME_SHOTS_MAX];
+    uint8_t shots_dirs; // bit per shot: 1 - backward, 0 - forward
 }
 dynamic __attribute__((used));
 static_assert(sizeof(dynamic) <= 24, "Out of SRAM"); // 8 bytes of SRAM left for the callstack
+static_assert(GAME_SHOTS_MAX <= 8, "Shot directions don't fit the mask");
 
 #define OFD(x) (uint8_t(reinterpret_cast<const uint8_t *>(x) - reinterpret_cast<const uint8_t *>(&dynamic)) + SRAM_DATA_OFFSET) // evaluates absolute address of var in SRAM
 
 // SRAM access intrinsics
 //
+#ifndef HAL_HOST
 #define mem_load(var) ({                                                 \
     uint8_t result;                                                      \
     asm volatile (                                                       \
@@ -606,9 +697,16 @@ static_assert(sizeof(dynamic) <= 24, "Out of SRAM"); // 8 bytes of SRAM left for
         , "r"(tmp)                                                       \
     );                                                                   \
 })
+#else
+#define mem_load(var) uint8_t(var)
+#define mem_load_inc(var, value) uint8_t((var) + (value))
+#define mem_load_reg(var, result) ((result) = (var))
+#define mem_store_reg(var, value) ((var) = uint8_t(value))
+#endif
 
 // Some player states is equal to the corresponding block offset
 //
+#ifndef HAL_HOST
 enum PlayerState : uint8_t {
     IDLE = EMPTY_BLOCK_OFX,
     IDLE_LADDER = OFX(tight.le.m),
@@ -619,15 +717,34 @@ enum PlayerState : uint8_t {
     WALK1 = 0xF3,
     DEATH = 0xF4,
 };
+#else
+namespace PlayerState { // offsets aren't constant expressions for a host compiler
+    static const uint8_t IDLE = EMPTY_BLOCK_OFX;
+    static const uint8_t IDLE_LADDER = OFX(tight.le.m);
+    static const uint8_t OBSTACLE_LEFT = OFX(tight.hl.m);
+    static const uint8_t OBSTACLE_RIGHT = OFX(tight.hr.m);
+    static const uint8_t WAIT = 0xF1;
+    static const uint8_t WALK = 0xF2;
+    static const uint8_t WALK1 = 0xF3;
+    static const uint8_t DEATH = 0xF4;
+}
+#endif
 
 // permanent register binding for global variables which are often used
 //
-volatile register uint8_t sequence_direction asm("r16");
-volatile register uint8_t player_img_offset asm("r17"); // compiler assumes that r17 is always zero. Not so wise for a core with reduced register file (only 16 registers available).
-volatile register uint8_t player_state asm("r18"); // so I have to avoid using zeros in the code. And, of course, check the generated assembly for r17 and r18
+volatile HAL_REGISTER(uint8_t, sequence_direction, "r16");
+volatile HAL_REGISTER(uint8_t, player_img_offset, "r17"); // compiler assumes that r17 is always zero. Not so wise for a core with reduced register file (only 16 registers available).
+volatile HAL_REGISTER(uint8_t, player_state, "r18"); // so I have to avoid using zeros in the code. And, of course, check the generated assembly for r17 and r18
+
+// timer isn't used so its compare register keeps current level: it survives 'rjmp game' and is zero after reset
+//
+#define game_level OCR0AL
+#define game_camera OCR0BL // first level column on the screen
+#define game_redraw ICR0L // pages of the view left to redraw after a camera step
 
 // general intrinsics
 //
+#ifndef HAL_HOST
 #define lpminc_y(addr) ({                                                \
     uint8_t result;                                                      \
     asm volatile (                                                       \
@@ -659,15 +776,6 @@ volatile register uint8_t player_state asm("r18"); // so I have to avoid using z
         , "+z"(addr)                                                     \
     );                                                                   \
 })
-#define lpmincv_z(addr, result, increment) ({                            \
-    asm volatile (                                                       \
-        "ld %0, %a1\n\t"                                                 \
-        "subi r30, %2\n\t"                                               \
-        : "=r"(result)                                                   \
-        , "+z"(addr)                                                     \
-        : "M"(256 - increment)                                           \
-    );                                                                   \
-})
 #define stm_z(addr, value) ({                                            \
     asm volatile (                                                       \
         "st %a0, %1\n\t"                                                 \
@@ -703,6 +811,48 @@ volatile register uint8_t player_state asm("r18"); // so I have to avoid using z
         : "M"(256 - value)                                               \
     );                                                                   \
 })
+#define ldi_zero(dest) ({                                                \
+    asm volatile (                                                       \
+        "ldi %0, 0\n\t"                                                  \
+        : "=d"(dest)                                                     \
+    );                                                                   \
+})
+#define rjmp_game() asm volatile("rjmp game")
+#else
+// the same on the host model of the data space (see host/hal.h), Z is a pair of bytes there
+//
+inline uint16_t z_load(volatile pair &z) {
+    return z.lo | (z.hi << 8);
+}
+inline uint16_t z_postinc(volatile pair &z) {
+    uint16_t address = z_load(z);
+    z.lo = address + 1;
+    z.hi = (address + 1) >> 8;
+    return address;
+}
+inline uint16_t z_predec(volatile pair &z) {
+    uint16_t address = z_load(z) - 1;
+    z.lo = address;
+    z.hi = address >> 8;
+    return address;
+}
+inline uint16_t z_load_word(volatile pair &z) {
+    uint8_t lo = hal::ld(z_postinc(z));
+    return lo | (hal::ld(z_load(z)) << 8);
+}
+
+#define lpminc_y(addr) hal::ld((addr)++)
+#define lpm_z(addr, result) ((result) = hal::ld(z_load(addr)))
+#define lpminc_z(addr, result) ((result) = hal::ld(z_postinc(addr)))
+#define lpminc_zw(out, addr) ((out) = z_load_word(addr))
+#define stm_z(addr, value) hal::st(z_load(addr), value)
+#define stminc_z(addr, value) hal::st(z_postinc(addr), value)
+#define stmdec_z(addr, value) hal::st(z_predec(addr), value)
+#define addreg(dest, reg) ((dest) += (reg))
+#define addval(dest, value) ((dest) += (value))
+#define ldi_zero(dest) ((dest) = 0)
+#define rjmp_game() throw hal::restart()
+#endif
 
 // input/output support (hardware SPI is used)
 //
@@ -715,6 +865,20 @@ namespace spi {
         UCSRA = 1 << TXC;
     }
 
+    // UDR is double buffered: the byte is queued as soon as the buffer is free, the previous one may be still shifting
+    // out. TXC isn't touched, it's set by every gap between bytes so it's cleared once after the last of them
+    //
+    inline void send_queued(uint8_t value) {
+        while (!(UCSRA & (1 << UDRE)));
+        UDR = value;
+    }
+
+    inline void send_last(uint8_t value) { // D/C may be changed after that
+        send_queued(value);
+        UCSRA = 1 << TXC;
+        send_sync();
+    }
+
     void send_dat_sequence(uint8_t offset, uint8_t count) __attribute__((naked, section(".init5")));
     void send_dat_sequence(uint8_t offset, uint8_t count) { // unified function to send compressed and uncompressed data
         set_bit_hi(port_dcs);
@@ -733,7 +897,7 @@ namespace spi {
         input;
 
         do {
-            volatile register pair ptr asm("r30") = { offset, __AVR_TINY_PM_BASE_ADDRESS__ >> 8 };
+            volatile HAL_REGISTER_LOCAL(pair, ptr, "r30") = { offset, __AVR_TINY_PM_BASE_ADDRESS__ >> 8 };
 
             if (counter >= 8) { // offset will be increased before drawing so OFN(...) is used instead of OFS(...)
                 counter -= 8;
@@ -763,12 +927,13 @@ namespace spi {
             lpm_z(ptr, value);
 
             { // shots drawing is right here
-                const uint8_t SHOTS_COORD_OFFSET = SRAM_DATA_OFFSET + uint8_t(uint16_t(dynamic.shots_coords) - uint16_t(&dynamic));
+                const uint8_t SHOTS_COORD_OFFSET = OFD(dynamic.shots_coords);
                 ptr.lo = SHOTS_COORD_OFFSET;
 
                 while (ptr.lo != SHOTS_COORD_OFFSET + GAME_SHOTS_MAX) {
                     ptr.hi = 0;
 
+#ifndef HAL_HOST
                     asm volatile ( // I spent a lot of time trying to avoid assebler here. GCC just can't do that in the way I want
                         "ld    %0, %a1+\n\t"
                         "mov   r31, %0\n\t"
@@ -781,6 +946,14 @@ namespace spi {
                         , "+r"(value)
                         : "X"(SRAM_DATA_OFFSET + uint16_t(&dynamic.draw_x_coord) - uint16_t(&dynamic))
                         );
+#else
+                    uint8_t shot = hal::ld(z_postinc(ptr));
+                    draw_position = dynamic.draw_x_coord;
+
+                    if (draw_position == shot) {
+                        value |= 0x02;
+                    }
+#endif
                 }
 
                 mem_store_reg(dynamic.draw_x_coord, ++draw_position);
@@ -788,20 +961,40 @@ namespace spi {
 
             counter += inc;
 
-            while (!(UCSRA & (1 << UDRE)));
-            UCSRA = 1 << TXC;
-            UDR = value;
+            send_queued(value); // decoding of the next byte overlaps shifting out of that one
         }
         while (--count);
+
+        UCSRA = 1 << TXC; // falls through to send_sync (next section) waiting for the last byte
+#ifdef HAL_HOST
+        send_sync(); // sections aren't laid out on the host
+#endif
     }
 
     void send_cmd_seq_3(const pair p, uint8_t r) {
         set_bit_lo(port_dcs);
-        UDR = p.hi;
-        asm("rcall send_sync");
-        UDR = p.lo;
-        asm("rcall send_sync");
-        UDR = r;
+        UDR = p.hi; // the line is idle after send_sync, the buffer is free
+        send_queued(p.lo);
+        send_last(r);
+    }
+
+    void send_zero_blocks(uint8_t count) { // blank blocks skip the decoder, the USART is the limit (32 cycles per byte)
+        uint8_t zero;
+        ldi_zero(zero); // constant zero would be taken from r17
+
+        set_bit_hi(port_dcs);
+
+        do {
+            uint8_t i = GAME_MAP_BLOCK_WIDTH;
+
+            do {
+                send_queued(zero);
+            }
+            while (--i);
+        }
+        while (--count);
+
+        UCSRA = 1 << TXC;
         send_sync();
     }
 }
@@ -810,6 +1003,7 @@ namespace spi {
 //
 namespace lib {
     void delay(uint8_t count) { // 'single frame calibrated pause' x count
+#ifndef HAL_HOST
         asm volatile (
             "ldi   r20, 255\n\t"
             "ldi   r21, 106\n\t"
@@ -820,13 +1014,79 @@ namespace lib {
             "brne  .-14\n\t"
             :: "r"(count)
             );
+#else
+        hal::delay_cycles(count * 109568UL); // the loop above: 256 x 107 x 4 cycles
+#endif
     }
 
+    // page addressing: every drawing stays on its page, so 0xB0 + page and two column nibbles replace the windows
+    //
     void set_coord(uint8_t v, uint8_t h) {
         mem_store_reg(dynamic.draw_x_coord, h);
-        spi::send_cmd_seq_3({ v, 0x22 }, { v });
-        spi::send_cmd_seq_3({ mem_load(dynamic.draw_x_coord), 0x21 }, { 127 });
+        spi::send_cmd_seq_3({ uint8_t(h & 0x0F), uint8_t(0xB0 | v) }, 0x10 | (h >> 4));
+    }
+}
+
+// level map reader: blocks are decoded one by one right from the program memory, no copy in SRAM
+//
+struct MapReader {
+    uint8_t offset;
+    uint8_t shift;
+
+    uint8_t next() {
+        union {
+            struct {
+                uint8_t lo;
+                uint8_t hi;
+            };
+
+            uint16_t word;
+        }
+        input;
+
+        volatile HAL_REGISTER_LOCAL(pair, ptr, "r30") = { offset, __AVR_TINY_PM_BASE_ADDRESS__ >> 8 };
+        lpminc_zw(input.word, ptr);
+        input.word >>= shift;
+
+        ptr.lo = OFS(normal.map_blocks);
+        shift++;
+
+        if (input.lo & 0b1) { // same encoding as graphics (see CompressingStrategy)
+            ptr.lo += ((input.lo / 2) & 0b1111) + 1;
+            shift += 4;
+        }
+        if (shift >= 8) {
+            shift -= 8;
+            offset++;
+        }
+
+        uint8_t block;
+        lpm_z(ptr, block);
+        return block;
+    }
+};
+
+MapReader open_level(uint8_t skip_blocks) {
+    MapReader reader;
+
+#ifdef WIDE_LEVELS
+    volatile HAL_REGISTER_LOCAL(pair, ptr, "r30") = { uint8_t(OFS(normal.levels) + game_level), __AVR_TINY_PM_BASE_ADDRESS__ >> 8 };
+    lpm_z(ptr, reader.offset);
+#else
+    reader.offset = OFT(tight.level_0.m);
+#endif
+    ldi_zero(reader.shift); // constant zero would be taken from r17
+
+    while (skip_blocks--) {
+        reader.next();
     }
+
+    return reader;
+}
+
+uint8_t camera() {
+    static_assert(GAME_MAP_WIDTH >= GAME_VIEW_BLOCKS, "Level is narrower than the screen");
+    return GAME_MAP_WIDTH > GAME_VIEW_BLOCKS ? game_camera : 0; // no camera at all for a single screen level
 }
 
 // game functions
@@ -835,6 +1095,33 @@ void draw_block(uint8_t block) {
     spi::send_dat_sequence(block & GAME_BLOCK_MASK, GAME_MAP_BLOCK_WIDTH);
 }
 
+// draws the visible part of one page of the level from the view block 'first' on. Odd pages are evaluated from the even
+// page above them
+//
+void draw_map_row(uint8_t page, uint8_t first) {
+    lib::set_coord(page, first * GAME_MAP_BLOCK_WIDTH);
+
+    MapReader map = open_level((page >> 1) * GAME_MAP_WIDTH + camera() + first);
+    uint8_t count = GAME_VIEW_BLOCKS - first;
+
+    do {
+        uint8_t block = map.next();
+
+        if (page & 0b1) {
+            block = block <= OFT(tight.fn.m) ? OFT(tight.lb.m) : OFT(tight.bs.m); // ladder continues under the ladder block
+        }
+
+        if ((block & GAME_BLOCK_MASK) == EMPTY_BLOCK_OFT) { // no shots on these rows, the decoder can be skipped
+            spi::send_zero_blocks(1);
+            continue;
+        }
+
+        mem_store_reg(dynamic.draw_x_coord, GAME_OBJECT_INACTIVE - GAME_MAP_BLOCK_WIDTH); // disable shot logic for that drawing
+        draw_block(block);
+    }
+    while (--count);
+}
+
 void draw_according_direction(uint8_t offset) {
     if (sequence_direction & 0x80) {
         offset += GAME_CHAR_WIDTH - 1;
@@ -855,8 +1142,9 @@ void set_walking_state() {
 }
 
 void add_shot(uint8_t position) {
-    volatile register pair ptr asm("r30") { OFD(dynamic.shots_coords), 0 };
+    volatile HAL_REGISTER_LOCAL(pair, ptr, "r30") { OFD(dynamic.shots_coords), 0 };
     uint8_t coord;
+    uint8_t bit = 0b1;
 
     if (!(sequence_direction & 0x80))
     {
@@ -868,11 +1156,35 @@ void add_shot(uint8_t position) {
 
         if (coord > GAME_SCREEN_WIDTH) {
             stmdec_z(ptr, position);
-            ptr.lo += GAME_SHOTS_MAX;
-            stm_z(ptr, sequence_direction);
+
+            uint8_t dirs = mem_load(dynamic.shots_dirs) & ~bit;
+
+            if (sequence_direction & 0x80) { // == SequenceDirection::BACKWARD
+                dirs |= bit;
+            }
+
+            mem_store_reg(dynamic.shots_dirs, dirs);
             break;
         }
+
+        bit <<= 1;
+    }
+}
+
+void shift_shots(uint8_t delta) { // shots stay over the map when the view moves, the ones it leaves behind go inactive
+    volatile HAL_REGISTER_LOCAL(pair, ptr, "r30") { OFD(dynamic.shots_coords), 0 };
+
+    do {
+        uint8_t coord;
+        lpm_z(ptr, coord);
+
+        if (coord <= GAME_SCREEN_WIDTH) { // wraps over GAME_SCREEN_WIDTH when it leaves the screen
+            coord += delta;
+        }
+
+        stminc_z(ptr, coord);
     }
+    while (ptr.lo != OFD(dynamic.shots_coords) + GAME_SHOTS_MAX);
 }
 
 uint8_t dist_to_player(uint8_t coord) {
@@ -901,7 +1213,7 @@ void game(void) {
     set_bit_hi(port_clk); // Display reset
     set_bit_lo(port_res);
 
-    volatile register pair sram_ptr asm("r30") { OFD(&dynamic.attack_counter), 0 }; // use pause before desplay reset to fill SRAM with default values
+    volatile HAL_REGISTER_LOCAL(pair, sram_ptr, "r30") { OFD(&dynamic.attack_counter), 0 }; // use pause before desplay reset to fill SRAM with default values
     uint8_t fill_value = GAME_UNIVERSAL_CONST;
 
     do {
@@ -914,68 +1226,54 @@ void game(void) {
     do {
         stminc_z(sram_ptr, fill_value);
     }
-    while (sram_ptr.lo != OFD(dynamic.shots_dirs));
+    while (sram_ptr.lo != OFD(&dynamic.shots_dirs));
 
     set_bit_hi(port_res);
-    spi::send_cmd_seq_3({ 0x00, 0x20 }, 0xAF);
+    spi::send_cmd_seq_3({ 0x00, 0x20 }, 0xAF); // title screen runs over all the pages in horizontal addressing
 
-    uint8_t map_block_counter = GAME_MAP_BYTE_SIZE - 1; // title screen
+    spi::send_zero_blocks(GAME_TITLE_BLOCK); // title screen: 64 blocks over the whole display
 
-    do {
-        volatile uint8_t offset = EMPTY_BLOCK_OFT;
-        volatile uint8_t length = GAME_MAP_BLOCK_WIDTH;
-
-        mem_store_reg(dynamic.draw_x_coord, length); // disable shot logic for that drawing
+    mem_store_reg(dynamic.draw_x_coord, GAME_MAP_BLOCK_WIDTH); // disable shot logic for that drawing
+    spi::send_dat_sequence(OFT(tight.title.m), 2 * GAME_MAP_BLOCK_WIDTH);
 
-        if (map_block_counter == 36) {
-            offset = OFT(tight.title.m);
-            length = 2 * GAME_MAP_BLOCK_WIDTH;
-        }
-
-        spi::send_dat_sequence(offset, length);
-    }
-    while (--map_block_counter);
+    spi::send_zero_blocks(GAME_MAP_BYTE_SIZE - GAME_TITLE_BLOCK - 2);
     while (is_key_use() == 0); // press 'action' to play
 
-    pair map_ptr = { OFS(normal.level_0), __AVR_TINY_PM_BASE_ADDRESS__ >> 8 }; // draw the level
-    register uint8_t map_ladder_offset asm("r16"); // binded register isn't used at this time so use it
+    spi::send_cmd_seq_3({ 0x02, 0x20 }, 0xB0); // page addressing for the game, see lib::set_coord
 
-    while (map_block_counter < GAME_MAP_BYTE_SIZE) {
-        volatile uint8_t block = OFT(tight.lb.m);
-        mem_store_reg(dynamic.draw_x_coord, block); // disable shot logic for that drawing (any value that big enough)
-
-        if ((map_block_counter & 0b1000) == 0) {
-            block = lpminc_y(map_ptr);
-
-            if (block <= OFT(tight.fn.m)) { // at even row I save ladder position
-                map_ladder_offset = map_block_counter;
-                addval(map_ladder_offset, 8);
-            }
-        }
-        else if (map_ladder_offset != map_block_counter) {
-            block = OFT(tight.bs.m);
-        }
+    if (GAME_MAP_WIDTH > GAME_VIEW_BLOCKS) {
+        uint8_t zero;
+        ldi_zero(zero);
+        game_camera = zero;
+        game_redraw = zero;
+    }
 
-        draw_block(block);
-        map_block_counter++;
+    for (uint8_t page = 0; page < GAME_VIEW_PAGES; page++) { // draw the level
+        draw_map_row(page, 0);
     }
 
     set_walking_state();
 
     while (true) { // main loop
+        HAL_PHASE(1);
 
-        volatile register pair shots_ptr asm("r30") { OFD(dynamic.shots_coords), 0 }; // update flying shots
+        // update flying shots. Only the active enemy can be hit (see enemy_v_last), so a shot costs two compares at
+        // most whatever the number of enemies
+        //
+        volatile HAL_REGISTER_LOCAL(pair, shots_ptr, "r30") { OFD(dynamic.shots_coords), 0 };
         uint8_t shots_count = GAME_SHOTS_MAX;
+        uint8_t shots_dirs = mem_load(dynamic.shots_dirs);
 
         do {
-            uint8_t inc;
             volatile uint8_t coord;
-
-            lpmincv_z(shots_ptr, coord, GAME_SHOTS_MAX);
-            lpmincv_z(shots_ptr, inc, (256 - GAME_SHOTS_MAX));
+            lpm_z(shots_ptr, coord);
 
             if (coord <= GAME_SCREEN_WIDTH) {
-                coord += inc;
+                coord += SequenceDirection::FORWARD;
+
+                if (shots_dirs & 0b1) {
+                    coord -= 2;
+                }
 
                 if (mem_load(dynamic.enemy_position_v) == mem_load(dynamic.player_position_v)) { // enemy hit
                     if (coord == mem_load_inc(dynamic.enemy_position_h, GAME_CHAR_HALF)) {
@@ -1003,17 +1301,18 @@ void game(void) {
 
                         set_bit_hi(port_dcs); // health bar decreasing
                         UDR = 0b01010000;
-                        spi::send_sync();
-                        UDR = 0b01010000;
-                        spi::send_sync();
+                        spi::send_last(0b01010000);
                     }
                 }
             }
 
             stminc_z(shots_ptr, coord);
+            shots_dirs >>= 1;
         }
         while (--shots_count);
 
+        HAL_PHASE(2);
+
         if (player_state < PlayerState::WALK) { // player state-machine
             player_img_offset = OFN(normal.actor_walk);
 
@@ -1085,8 +1384,19 @@ void game(void) {
                             lib::delay(GAME_LADDER_DELAY);
                         }
 
-                        if (player_position_v == GAME_MAP_TOP_STAGE) { // restart (win)
-                            asm volatile("rjmp game");
+                        if (player_position_v == GAME_MAP_TOP_STAGE) { // next level (win)
+                            if (GAME_LEVELS > 1) {
+                                uint8_t level = game_level + 1;
+
+                                if (level == GAME_LEVELS) {
+                                    ldi_zero(level);
+                                }
+
+                                game_level = level;
+                            }
+
+                            HAL_PHASE(6);
+                            rjmp_game();
                         }
 
                         player_img_offset = OFN(normal.ladder_single);
@@ -1106,6 +1416,7 @@ void game(void) {
             }
         }
 
+        uint8_t view = camera();
         uint8_t time_counter = mem_load_inc(dynamic.time_counter, 1);
         mem_store_reg(dynamic.time_counter, time_counter);
 
@@ -1121,6 +1432,20 @@ void game(void) {
                 }
 
                 uint8_t position = mem_load(dynamic.player_position_h) + sequence_direction;
+
+                if (GAME_MAP_WIDTH > GAME_VIEW_BLOCKS) { // camera follows the player keeping the margin
+                    uint8_t camera = game_camera;
+
+                    if (position == GAME_SCREEN_WIDTH - GAME_CAMERA_MARGIN && camera != GAME_MAP_WIDTH - GAME_VIEW_BLOCKS) {
+                        game_camera = camera + 1;
+                        position -= GAME_MAP_BLOCK_WIDTH;
+                    }
+                    if (position == GAME_CAMERA_MARGIN && camera) {
+                        game_camera = camera - 1;
+                        position += GAME_MAP_BLOCK_WIDTH;
+                    }
+                }
+
                 mem_store_reg(dynamic.player_position_h, position);
 
                 if (sequence_direction & 0x80) { // == SequenceDirection::BACKWARD
@@ -1131,16 +1456,32 @@ void game(void) {
             }
         }
 
+        HAL_PHASE(3);
+
+        if (camera() != view) { // the view is redrawn over the next frames, so traffic doesn't depend on the level width
+            game_redraw = GAME_VIEW_PAGES;
+            shift_shots((view - camera()) * GAME_MAP_BLOCK_WIDTH);
+        }
+
+        if (GAME_MAP_WIDTH > GAME_VIEW_BLOCKS && game_redraw) { // GAME_REDRAW_PAGES per frame from the top, hp stays
+            static_assert(GAME_VIEW_PAGES % GAME_REDRAW_PAGES == 0, "Redraw would run over the last page");
+
+            uint8_t page = GAME_VIEW_PAGES - game_redraw;
+            game_redraw = game_redraw - GAME_REDRAW_PAGES;
+
+            do {
+                draw_map_row(page, page ? 0 : GAME_HUD_BLOCKS);
+            }
+            while (++page % GAME_REDRAW_PAGES);
+        }
+
         lib::set_coord(mem_load(dynamic.player_position_v), 0);
 
-        uint8_t block_offset = OFS(normal.level_0) + mem_load(dynamic.player_position_v) * 4;
+        MapReader map = open_level(mem_load(dynamic.player_position_v) / 2 * GAME_MAP_WIDTH + camera());
         uint8_t block_count = GAME_CHAR_WIDTH;
 
         while (block_count < GAME_SCREEN_WIDTH + GAME_CHAR_WIDTH) {
-            uint8_t block;
-            register pair map_addr asm("r30") = { block_offset, __AVR_TINY_PM_BASE_ADDRESS__ >> 8 };
-
-            lpm_z(map_addr, block);
+            uint8_t block = map.next();
             draw_block(block);
 
             uint8_t player_position_h = mem_load(dynamic.player_position_h);
@@ -1152,30 +1493,40 @@ void game(void) {
             }
 
             block_count += GAME_MAP_BLOCK_WIDTH;
-            block_offset++;
         }
 
         draw_player(mem_load(dynamic.player_position_v)); // redraw player
 
+        HAL_PHASE(4);
+
         uint8_t enemy_offset = GAME_ENEMIES_OFFSET; // drawing enemies
         uint8_t saved_direction = sequence_direction;
 
         while (true) {
-            volatile register pair ptr asm("r30") = { enemy_offset, __AVR_TINY_PM_BASE_ADDRESS__ >> 8 };
+            volatile HAL_REGISTER_LOCAL(pair, ptr, "r30") = { enemy_offset, __AVR_TINY_PM_BASE_ADDRESS__ >> 8 };
             uint8_t pos;
 
             lpminc_z(ptr, pos);
+            pos -= camera() * GAME_MAP_BLOCK_WIDTH;
             mem_store_reg(dynamic.enemy_position_h, pos);
 
             lpminc_z(ptr, sequence_direction);
-            lib::set_coord(enemy_offset, pos);
+
+            bool visible = GAME_MAP_WIDTH == GAME_VIEW_BLOCKS || pos <= GAME_SCREEN_WIDTH - GAME_CHAR_WIDTH;
+
+            if (visible) {
+                lib::set_coord(enemy_offset, pos);
+            }
 
             uint8_t last_v = mem_load(dynamic.enemy_v_last);
 
             if (enemy_offset > last_v) break; // all enemies have been killed
             if (enemy_offset == last_v) {
                 uint8_t img = mem_load(dynamic.enemy_img_offset);
-                draw_according_direction(img);
+
+                if (visible) {
+                    draw_according_direction(img);
+                }
 
                 if (img != OFN(normal.actor_walk)) {  // enemy death
                     enemy_offset -= GAME_MAP_STAGE_DIFF;
@@ -1192,7 +1543,7 @@ void game(void) {
                         }
                     }
                 }
-                if ((mem_load(dynamic.time_counter) & 0b11111) == 0) { // enemy shooting
+                if (visible && (mem_load(dynamic.time_counter) & 0b11111) == 0) { // enemy shooting, in the view only
                     if (enemy_offset == mem_load(dynamic.player_position_v)) {
                         if (dist_to_player(mem_load(dynamic.enemy_position_h)) < GAME_DIST_TO_ATTACK) {
                             add_shot(mem_load(dynamic.enemy_position_h));
@@ -1203,15 +1554,21 @@ void game(void) {
                 break;
             }
 
-            draw_according_direction(OFN(normal.actor_walk));
+            if (visible) {
+                draw_according_direction(OFN(normal.actor_walk));
+            }
+
             enemy_offset += sizeof(Enemy);
         }
 
+        HAL_PHASE(5);
         lib::delay(1);
 
         if (player_state == PlayerState::DEATH) { // restart (lose)
+            HAL_PHASE(6);
+            HAL_GAME_OVER(game_level);
             lib::delay(GAME_DEATH_DELAY);
-            asm volatile("rjmp game");
+            rjmp_game();
         }
 
         sequence_direction = saved_direction;
@@ -1221,7 +1578,30 @@ void game(void) {
 
 void main() __attribute__((naked, noreturn, section(".init0")));
 void main(void) {
+#ifndef HAL_HOST
     asm("rjmp game");
+#else
+    game();
+#endif
+}
+
+#ifdef HAL_HOST
+// host image of the flash as the linker lays it out (.init0 .. .init3), SRAM of every machine starts with 'dynamic'
+//
+static struct FlashImage {
+    static void bind_sram() {
+        hal::sram = reinterpret_cast<uint8_t *>(&dynamic);
+        hal::sram_size = sizeof(dynamic);
+    }
+
+    FlashImage() {
+        memcpy(hal::flash + 2, &enemies, sizeof(enemies));
+        memcpy(hal::flash + PGM_DATA_OFFSET, &tight, sizeof(tight));
+        memcpy(hal::flash + PGM_DATA_OFFSET + sizeof(tight), &normal, sizeof(normal));
+        hal::power_on = bind_sram;
+    }
 }
+flash_image;
+#endif
 
 // kas-shaman 2020
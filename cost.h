@@ -0,0 +1,57 @@
+//
+// Compile-time cost model of the display traffic
+//
+// A drawing step costs bytes on the display bus and CPU cycles. A game builds the steps of its worst frame from the
+// costs of its primitives (cycles per byte of the display backend, chars<>::size, font::DIGIT_WIDTH, the constants
+// and loop bounds of its drawing functions), its typical frame the same way, and static_asserts that the worst frame
+// fits the budget: a change that makes a frame slower fails to compile instead of showing up as stutter. Game logic
+// between the steps isn't counted.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+namespace cost {
+    struct Cost {
+        uint32_t bytes;
+        uint32_t cycles;
+
+        constexpr Cost operator+(const Cost &other) const {
+            return Cost{ bytes + other.bytes, cycles + other.cycles };
+        }
+
+        constexpr Cost operator*(uint32_t count) const {
+            return Cost{ bytes * count, cycles * count };
+        }
+    };
+
+    // 'count' bytes of a primitive that spends 'cycles' per byte
+    //
+    constexpr Cost bytes(uint32_t count, uint32_t cycles) {
+        return Cost{ count, count * cycles };
+    }
+
+    // the largest of the alternatives (sprites drawn at the same place)
+    //
+    constexpr uint32_t widest(uint32_t size) {
+        return size;
+    }
+
+    template <typename... T> constexpr uint32_t widest(uint32_t a, uint32_t b, T... rest) {
+        return widest(a > b ? a : b, rest...);
+    }
+
+    // the slower of two ways a step may draw (branches of the drawing code)
+    //
+    constexpr Cost slower(const Cost &a, const Cost &b) {
+        return a.cycles > b.cycles ? a : b;
+    }
+
+    // drawing cycles of the worst frame at the clock: with the pause of the game loop its period is two typical frames
+    // at most (pause and the modeled drawing of a typical frame), the frame rate halves for it and no further
+    //
+    constexpr uint32_t budget(uint32_t pause_ms, const Cost &typical, uint32_t f_cpu) {
+        return pause_ms * (f_cpu / 1000) + 2 * typical.cycles;
+    }
+}
@@ -0,0 +1,70 @@
+//
+// Packed 3x5 digit font shared by the games
+//
+// Every glyph is 3 columns of 5 pixels packed into 15 bits of a word (first column in the low bits),
+// so 10 digits take 20 bytes of flash and nothing of SRAM.
+//
+// Scores are kept as packed BCD (two digits per byte) and go to the display without any conversion.
+//
+
+#pragma once
+
+#include "hal.h"
+
+namespace font {
+    constexpr uint16_t glyph(uint8_t c0, uint8_t c1, uint8_t c2) {
+        return c0 | (uint16_t(c1) << 5) | (uint16_t(c2) << 10);
+    }
+
+    static const uint16_t digits[10] PROGMEM = {
+        glyph(0x1F, 0x11, 0x1F), // '0'
+        glyph(0x12, 0x1F, 0x10), // '1'
+        glyph(0x1D, 0x15, 0x17), // '2'
+        glyph(0x11, 0x15, 0x1F), // '3'
+        glyph(0x07, 0x04, 0x1F), // '4'
+        glyph(0x17, 0x15, 0x1D), // '5'
+        glyph(0x1F, 0x15, 0x1D), // '6'
+        glyph(0x01, 0x1D, 0x03), // '7'
+        glyph(0x1F, 0x15, 0x1F), // '8'
+        glyph(0x17, 0x15, 0x1F), // '9'
+    };
+
+    static const uint8_t DIGIT_WIDTH = 4; // columns sent by draw_digit
+
+    // 'Shift' moves the glyph down inside the page, one empty column is sent after the glyph
+    //
+    template <void (*f)(uint8_t), uint8_t Shift = 0> void __attribute__ ((noinline)) draw_digit(uint8_t digit) {
+        uint16_t columns = pgm_read_word(&digits[digit]);
+        uint8_t i = 3;
+
+        do {
+            f(uint8_t(columns & 0x1F) << Shift);
+            columns >>= 5;
+        }
+        while (--i);
+
+        f(0x0);
+    }
+
+    // two digits of the packed BCD, high one first
+    //
+    template <void (*f)(uint8_t), uint8_t Shift = 0> void draw_number(uint8_t bcd) {
+        draw_digit<f, Shift>(bcd >> 4);
+        draw_digit<f, Shift>(bcd & 0x0F);
+    }
+
+    // returns true when the counter wraps 99 -> 00
+    //
+    inline bool bcd_inc(uint8_t &bcd) {
+        if ((++bcd & 0x0F) == 10) {
+            bcd += 6;
+
+            if (bcd == 0xA0) {
+                bcd = 0;
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
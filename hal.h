@@ -0,0 +1,92 @@
+//
+// Hardware abstraction for the games
+//
+// The AVR build (default) gets the usual avr-libc headers and every macro below expands to exactly what the games
+// had written by hand, so the firmware doesn't change. Building with HAL_HOST compiles a game natively against
+// the host model of the microcontroller and the display (see host/hal.h, host/run.cpp).
+//
+
+#pragma once
+
+// clock profile of the attiny13a/85 games (-DCLOCK_PROFILE=n): HAL_CLOCK_INIT sets the internal oscillator divided by
+// 2^n (CLKPR prescaler, 0: 9.6 MHz on attiny13a, 8 MHz on attiny85) instead of the 1 MHz of the CKDIV8 fuse,
+// a game defines F_CPU by HAL_CLOCK_OSC so _delay_ms keeps its length
+//
+#if defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+#define HAL_CLOCK_OSC 8000000L
+#else
+#define HAL_CLOCK_OSC 9600000L
+#endif
+
+// phase marks of the instrumentation build (-DPHASE_TRACE): HAL_PHASE(n) pulses the game's spare pin (PHASE_PORT,
+// PHASE_BIT) high for n x HAL_PHASE_UNIT cycles, the phase n lasts until the next mark. tools/phase_report.py turns a
+// trace of the pin into per-phase times. A mark costs (n + 1) x 8 cycles or so, the default build has none
+//
+#ifdef PHASE_TRACE
+#define HAL_PHASE_UNIT 8
+#define HAL_PHASE_MASK (1 << PHASE_BIT)
+#define HAL_PHASE(n) do { \
+    PHASE_PORT |= HAL_PHASE_MASK; HAL_DELAY_CYCLES((n) * HAL_PHASE_UNIT - 2); PHASE_PORT &= ~HAL_PHASE_MASK; } while (0)
+#else
+#define HAL_PHASE_MASK 0
+#define HAL_PHASE(n) do {} while (0)
+#endif
+
+#ifdef HAL_HOST
+#include "host/hal.h"
+#else
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+// clock profile: avr-libc does the timed CLKPR sequence (interrupts off around it)
+//
+#ifdef CLOCK_PROFILE
+#include <avr/power.h>
+#define HAL_CLOCK_INIT() clock_prescale_set(clock_div_t(CLOCK_PROFILE))
+#else
+#define HAL_CLOCK_INIT() do {} while (0)
+#endif
+
+#ifdef F_CPU
+#include <util/delay.h>
+#endif
+
+// global variable bound to a register
+//
+#define HAL_REGISTER(type, name, reg) register type name asm(reg)
+
+// local variable bound to a register (inline assembler expects it there)
+//
+#define HAL_REGISTER_LOCAL(type, name, reg) register type name asm(reg)
+
+// global variable with game state (the host keeps a copy per simulated machine)
+//
+#define HAL_STATE
+
+// linker section of a HAL_STATE variable (thread local storage can't be placed on the host)
+//
+#define HAL_SECTION(name) __attribute__((section(name)))
+
+// initial value of a 'random' state, the host runner replaces it by a seeded one
+//
+#define HAL_SEED(value) (value)
+
+// local variable the firmware leaves uninitialized (the host gives it a seeded power-on value)
+//
+#define HAL_NOINIT
+
+// the player lost, the host runner collects score and game duration
+//
+#define HAL_GAME_OVER(score)
+
+// data walked by a pointer whose low byte only is incremented: the firmware keeps it within a 256 byte page (SRAM of
+// the attiny13a ends at 0x9F), the host has to align it
+//
+#define HAL_PAGE_LOCAL
+
+// exact busy wait (phase marks)
+//
+#define HAL_DELAY_CYCLES(cycles) __builtin_avr_delay_cycles(cycles)
+
+#endif
@@ -0,0 +1,349 @@
+//
+// Host model of the hardware, see hal.h
+//
+
+#include "hal.h"
+
+namespace hal {
+    thread_local Machine machine;
+
+    reg io[reg::count] = {
+        reg(reg::porta), reg(reg::portb), reg(reg::pina), reg(reg::pinb), reg(reg::ddra), reg(reg::ddrb),
+        reg(reg::puea), reg(reg::udr), reg(reg::ucsra), reg(reg::ucsrb), reg(reg::ucsrc), reg(reg::ubrrl),
+        reg(reg::ccp), reg(reg::clkpsr), reg(reg::ocr0al), reg(reg::ocr0bl), reg(reg::icr0l), reg(reg::tcnt0l),
+        reg(reg::usidr), reg(reg::usisr), reg(reg::usicr), reg(reg::clkpr),
+    };
+
+    uint8_t flash[1024];
+    thread_local uint8_t *sram;
+    thread_local size_t sram_size;
+
+    void (*power_on)();
+
+    // wiring: attiny13a games bit-bang PORTB (or use USI pins DO and USCK with OLED1306_USI), attiny104 game uses
+    // USART with D/C and RES on PORTA
+    //
+#ifdef OLED1306_USI
+    static const uint8_t BITBANG_RES = 1 << 4;
+    static const uint8_t BITBANG_DC = 1 << 3;
+    static const uint8_t BITBANG_DIN = 1 << 1;
+    static const uint8_t BITBANG_CLK = 1 << 2;
+#else
+    static const uint8_t BITBANG_RES = 1 << 1;
+    static const uint8_t BITBANG_DC = 1 << 2;
+    static const uint8_t BITBANG_DIN = 1 << 3;
+    static const uint8_t BITBANG_CLK = 1 << 4;
+#endif
+    static const uint8_t USART_RES = 1 << 6;
+    static const uint8_t USART_DC = 1 << 7;
+
+    // number of argument bytes that follow a command
+    //
+    static uint8_t command_arguments(uint8_t cmd) {
+        switch (cmd) {
+            case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3: case 0xD5: case 0xD8: case 0xD9: case 0xDA: case 0xDB:
+                return 1;
+            case 0x21: case 0x22: case 0xA3:
+                return 2;
+            case 0x29: case 0x2A:
+                return 5;
+            case 0x26: case 0x27:
+                return 6;
+            default:
+                return 0;
+        }
+    }
+
+    void Display::reset() {
+        memset(ram, 0, sizeof(ram)); // undefined on the real display
+        mode = 2;
+        col = col_start = 0;
+        col_end = 127;
+        page = page_start = 0;
+        page_end = 7;
+        start_line = 0;
+        on = inverse = false;
+        cmd_length = cmd_expected = 0;
+    }
+
+    void Display::command(uint8_t byte) {
+        cmd[cmd_length++] = byte;
+
+        if (cmd_length == 1) {
+            cmd_expected = 1 + command_arguments(byte);
+        }
+        if (cmd_length < cmd_expected) {
+            return;
+        }
+
+        cmd_length = 0;
+
+        switch (cmd[0]) {
+            case 0x20:
+                mode = cmd[1] & 0b11;
+                break;
+            case 0x21:
+                col = col_start = cmd[1] & 0x7F;
+                col_end = cmd[2] & 0x7F;
+                break;
+            case 0x22:
+                page = page_start = cmd[1] & 0b111;
+                page_end = cmd[2] & 0b111;
+                break;
+            case 0xA6: case 0xA7:
+                inverse = cmd[0] & 1;
+                break;
+            case 0xAE: case 0xAF:
+                on = cmd[0] & 1;
+                break;
+            default:
+                if (cmd[0] >= 0x40 && cmd[0] <= 0x7F) {
+                    start_line = cmd[0] & 0x3F;
+                }
+                else if (mode == 2 && cmd[0] >= 0xB0 && cmd[0] <= 0xB7) {
+                    page = cmd[0] & 0b111;
+                }
+                else if (mode == 2 && cmd[0] <= 0x0F) {
+                    col = (col & 0xF0) | cmd[0];
+                }
+                else if (mode == 2 && cmd[0] >= 0x10 && cmd[0] <= 0x17) {
+                    col = (col & 0x0F) | ((cmd[0] & 0x7) << 4);
+                }
+                break;
+        }
+    }
+
+    void Display::data(uint8_t byte) {
+        ram[page][col] = byte;
+
+        if (mode == 0) { // horizontal
+            if (col++ == col_end) {
+                col = col_start;
+                page = page == page_end ? page_start : page + 1;
+            }
+        }
+        else if (mode == 1) { // vertical
+            if (page++ == page_end) {
+                page = page_start;
+                col = col == col_end ? col_start : col + 1;
+            }
+        }
+        else { // page
+            col = (col + 1) & 0x7F;
+        }
+    }
+
+    void Machine::reset() {
+        memset(this, 0, sizeof(*this));
+        display.reset();
+        cycles_limit = ~uint64_t(0);
+        frames_limit = ~uint32_t(0);
+
+        if (power_on) {
+            power_on();
+        }
+    }
+
+    void Machine::tick(uint32_t count) {
+        cycles += count;
+
+        if (cycles >= cycles_limit) {
+            throw stop();
+        }
+    }
+
+    void Machine::delay(uint32_t count) {
+        if (frame_bytes) { // the first pause after drawing finishes the frame
+            frames++;
+
+            if (frame_bytes > frame_bytes_max) {
+                frame_bytes_max = frame_bytes;
+            }
+            if (on_frame) {
+                on_frame(*this);
+            }
+
+            frame_bytes = 0;
+            frame_start = cycles;
+
+            if (frames >= frames_limit) {
+                throw stop();
+            }
+        }
+
+        tick(count);
+    }
+
+    void Machine::send(uint8_t byte, bool is_data) {
+        bytes++;
+        frame_bytes++;
+
+        if (is_data) {
+            display.data(byte);
+        }
+        else {
+            command_bytes++;
+            display.command(byte);
+        }
+    }
+
+    uint32_t reg::usart_byte_cycles() { // MSPIM: f / (2 x (UBRR + 1)) bits per second
+        return 16 * (io[reg::ubrrl].value() + 1);
+    }
+
+    uint8_t reg::read() {
+        machine.tick(1);
+
+        if (id == ucsra && machine.last_io == ucsra) {
+            machine.tx_stall++;
+
+            if (machine.last_ucsra & (1 << UDRE)) { // a loop on UDRE would be over
+                machine.tx_drain_stall++;
+            }
+        }
+
+        machine.last_io = id;
+
+        switch (id) {
+            case pina:
+                return machine.input ? machine.input(machine, 0) : 0xFF;
+            case pinb:
+                return machine.input ? machine.input(machine, 1) : 0;
+            case ucsra: {
+                uint8_t flags = value() & ~((1 << UDRE) | (1 << TXC));
+
+                if (machine.tx_done <= machine.cycles + usart_byte_cycles()) { // the shift register has the last byte
+                    flags |= 1 << UDRE;
+                }
+                if (machine.tx_done <= machine.cycles && machine.tx_done > machine.txc_cleared) {
+                    flags |= 1 << TXC;
+                }
+
+                machine.last_ucsra = flags;
+                return flags;
+            }
+            default:
+                return value();
+        }
+    }
+
+    void reg::write(uint8_t v) {
+        machine.tick(1);
+        machine.last_io = id;
+        update(v);
+    }
+
+    void reg::update(uint8_t v) {
+        uint8_t old = value();
+        value() = v;
+
+        if (id == portb) {
+            if ((old & BITBANG_RES) && !(v & BITBANG_RES)) {
+                machine.display.reset();
+                machine.bitbang_count = 0;
+            }
+            if (!(old & BITBANG_CLK) && (v & BITBANG_CLK) && (v & BITBANG_RES)) { // sampled on the rising edge, MSB first
+                // (the display ignores the bus while it's in reset)
+                bool usi = io[usicr].value() & (1 << USIWM0); // three-wire mode: DO is the MSB of USIDR
+                bool din = usi ? (io[usidr].value() & 0x80) : (v & BITBANG_DIN);
+
+                machine.bitbang_shift = (machine.bitbang_shift << 1) | (din ? 1 : 0);
+
+                if (++machine.bitbang_count == 8) {
+                    machine.bitbang_count = 0;
+                    machine.send(machine.bitbang_shift, v & BITBANG_DC);
+                }
+            }
+        }
+        else if (id == porta) {
+            if ((old & USART_RES) && !(v & USART_RES)) {
+                machine.display.reset();
+            }
+        }
+        else if (id == udr) {
+            machine.tx_done = (machine.tx_done > machine.cycles ? machine.tx_done : machine.cycles) + usart_byte_cycles();
+
+            if (io[porta].value() & USART_RES) { // the display ignores the bus while it's in reset
+                machine.send(v, io[porta].value() & USART_DC);
+            }
+        }
+        else if (id == ucsra) {
+            if (v & (1 << TXC)) {
+                machine.txc_cleared = machine.cycles;
+            }
+
+            value() &= ~(1 << TXC);
+        }
+        else if (id == usicr) { // software clock strobe: USITC toggles USCK, USICLK shifts the data register
+            if (v & (1 << USITC)) {
+                io[portb].update(io[portb].value() ^ BITBANG_CLK);
+            }
+            if (v & (1 << USICLK)) {
+                io[usidr].value() <<= 1;
+            }
+        }
+
+        if (machine.on_io) {
+            machine.on_io(machine, id, v);
+        }
+    }
+
+    uint8_t lines() {
+        const uint8_t *io = machine.io; // values, a trace must not advance the clock
+
+        if (io[reg::ucsrb] & (1 << TXEN)) {
+            return (io[reg::porta] & USART_RES ? LINE_RES : 0) | (io[reg::porta] & USART_DC ? LINE_DC : 0);
+        }
+
+        uint8_t port = io[reg::portb];
+        bool din = (io[reg::usicr] & (1 << USIWM0)) ? (io[reg::usidr] & 0x80) : (port & BITBANG_DIN);
+
+        return (port & BITBANG_RES ? LINE_RES : 0) | (port & BITBANG_DC ? LINE_DC : 0) | (din ? LINE_DIN : 0) |
+            (port & BITBANG_CLK ? LINE_CLK : 0);
+    }
+
+    uint8_t seed(uint8_t value) {
+        if (machine.seed == 0) {
+            return value;
+        }
+        if (machine.seed_state == 0) {
+            machine.seed_state = machine.seed * 0x9E3779B9u | 1;
+        }
+
+        uint32_t &x = machine.seed_state; // xorshift32
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+
+        return x >> 24;
+    }
+
+    void game_over(uint32_t score) {
+        if (machine.on_game_over) {
+            machine.on_game_over(machine, score);
+        }
+
+        machine.game_start = machine.frames;
+    }
+
+    uint8_t ld(uint16_t address) {
+        machine.tick(1);
+
+        if (address >= __AVR_TINY_PM_BASE_ADDRESS__) {
+            return flash[(address - __AVR_TINY_PM_BASE_ADDRESS__) & (sizeof(flash) - 1)];
+        }
+        if (address >= 0x40 && address - 0x40u < sram_size) {
+            return sram[address - 0x40];
+        }
+
+        return 0;
+    }
+
+    void st(uint16_t address, uint8_t value) {
+        machine.tick(1);
+
+        if (address >= 0x40 && address - 0x40u < sram_size) {
+            sram[address - 0x40] = value;
+        }
+    }
+}
@@ -0,0 +1,234 @@
+//
+// Host (native) model of the hardware the games use
+//
+// IO registers are objects that watch their accesses: bit-banged transfers on PORTB (attiny13a games), USI
+// strobes (the same games built with OLED1306_USI) and USART transfers through UDR (attiny104 game) are decoded
+// into an SSD1306 model with its 128x64 GDDRAM.
+// Time is virtual: delays and register accesses advance the cycle counter, nothing really sleeps. The USART shifts a
+// byte in 16 x (UBRR + 1) cycles, so UDRE and TXC follow the cycle counter like on the chip.
+//
+// A frame is finished by the first delay after any display traffic. The runner gets a callback after every frame
+// (statistics, snapshots), scripts the input pins and ends the run by a frame or cycle limit, see hal::Machine.
+//
+// All the state is thread local: every thread is a separate machine with its own copy of the game globals, so a
+// runner may simulate many instances in parallel (a fresh thread starts from power-on state). Register objects are
+// shared and keep their values in the machine, games may bind references to them during static initialization.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace hal {
+    struct stop {};    // thrown when the run is over
+    struct restart {}; // 'rjmp' to the game entry, the runner starts the game again
+
+    // SSD1306 subset: horizontal/vertical/page addressing, column and page windows, GDDRAM
+    //
+    struct Display {
+        uint8_t ram[8][128];
+        uint8_t mode;
+        uint8_t col, col_start, col_end;
+        uint8_t page, page_start, page_end;
+        uint8_t start_line;
+        bool on, inverse;
+
+        uint8_t cmd[8];
+        uint8_t cmd_length, cmd_expected;
+
+        void reset();
+        void command(uint8_t byte);
+        void data(uint8_t byte);
+
+        bool pixel(uint8_t x, uint8_t y) const {
+            return (ram[y >> 3][x] >> (y & 7)) & 1;
+        }
+    };
+
+    struct Machine {
+        Display display;
+
+        uint64_t cycles;          // estimate: delays plus one cycle per IO register access
+        uint64_t cycles_limit;    // hal::stop is thrown after that
+        uint32_t frames;
+        uint32_t frames_limit;
+        uint32_t bytes;           // display bytes since the start
+        uint32_t command_bytes;   // part of them sent with D/C low (addressing, modes)
+        uint32_t frame_bytes;     // display bytes of the current frame
+        uint32_t frame_bytes_max;
+        uint64_t frame_start;     // cycles at the start of the current frame
+
+        uint8_t (*input)(Machine &, uint8_t port); // input pins of PINA (0) or PINB (1), the runner scripts them
+
+        uint32_t seed;            // 0 keeps the firmware initial values, see HAL_SEED
+        uint32_t seed_state;
+        uint32_t game_start;      // frame the current game started at
+
+        uint8_t io[32];           // IO register values, see hal::reg
+        uint8_t bitbang_shift, bitbang_count;
+
+        uint64_t tx_done;         // cycle the USART shifts out its last queued byte at
+        uint64_t txc_cleared;     // cycle TXC was cleared at
+        uint64_t tx_stall;        // cycles of polling UCSRA (every read but the last of a run)
+        uint64_t tx_drain_stall;  // part of them spent on waiting for TXC with a free buffer
+        uint8_t last_io;          // register of the last access
+        uint8_t last_ucsra;
+
+        void (*on_frame)(Machine &);
+        void (*on_game_over)(Machine &, uint32_t score);
+        void (*on_io)(Machine &, uint8_t id, uint8_t value); // after every IO register write (traces)
+        void *user;
+
+        void reset();
+        void tick(uint32_t count);
+        void delay(uint32_t cycles);
+        void send(uint8_t byte, bool is_data);
+    };
+
+    extern thread_local Machine machine;
+
+    // IO register: accesses go to the machine of the thread
+    //
+    class reg {
+    public:
+        enum Id : uint8_t {
+            porta, portb, pina, pinb, ddra, ddrb, puea, udr, ucsra, ucsrb, ucsrc, ubrrl,
+            ccp, clkpsr, ocr0al, ocr0bl, icr0l, tcnt0l, usidr, usisr, usicr, clkpr, count
+        };
+
+        explicit reg(Id id) : id(id) {}
+
+        operator uint8_t() {
+            return read();
+        }
+
+        reg &operator=(uint8_t v) {
+            write(v);
+            return *this;
+        }
+        reg &operator|=(uint8_t v) {
+            write(value() | v);
+            return *this;
+        }
+        reg &operator&=(uint8_t v) {
+            write(value() & v);
+            return *this;
+        }
+        reg &operator^=(uint8_t v) {
+            write(value() ^ v);
+            return *this;
+        }
+
+    private:
+        uint8_t read();
+        void write(uint8_t v);
+        void update(uint8_t v);
+        static uint32_t usart_byte_cycles();
+
+        uint8_t &value() const {
+            return machine.io[id];
+        }
+
+        Id id;
+    };
+
+    static_assert(reg::count <= sizeof(Machine::io), "IO register values don't fit the machine");
+
+    extern reg io[reg::count];
+
+    // data space of the reduced core: IO, SRAM from 0x40, program memory mapped from 0x4000
+    //
+    extern uint8_t flash[1024];           // shared: written by static initialization only
+    extern thread_local uint8_t *sram;    // the game points it to its SRAM variables, see power_on
+    extern thread_local size_t sram_size;
+
+    extern void (*power_on)(); // called by Machine::reset in the machine's thread, the game binds its state there
+
+    uint8_t ld(uint16_t address);
+    void st(uint16_t address, uint8_t value);
+
+    // display lines as the display sees them (traces): RES, D/C and the bit-banged or USI data and clock, only RES and
+    // D/C while the USART transmitter is on (its bytes are the writes to UDR)
+    //
+    enum Line : uint8_t { LINE_RES = 1, LINE_DC = 2, LINE_DIN = 4, LINE_CLK = 8 };
+
+    uint8_t lines();
+
+    inline void delay_cycles(uint32_t cycles) {
+        machine.delay(cycles);
+    }
+
+    uint8_t seed(uint8_t value);
+    void game_over(uint32_t score);
+}
+
+#define PORTA (hal::io[hal::reg::porta])
+#define PORTB (hal::io[hal::reg::portb])
+#define PINA (hal::io[hal::reg::pina])
+#define PINB (hal::io[hal::reg::pinb])
+#define DDRA (hal::io[hal::reg::ddra])
+#define DDRB (hal::io[hal::reg::ddrb])
+#define PUEA (hal::io[hal::reg::puea])
+#define UDR (hal::io[hal::reg::udr])
+#define UCSRA (hal::io[hal::reg::ucsra])
+#define UCSRB (hal::io[hal::reg::ucsrb])
+#define UCSRC (hal::io[hal::reg::ucsrc])
+#define UBRRL (hal::io[hal::reg::ubrrl])
+#define CCP (hal::io[hal::reg::ccp])
+#define CLKPSR (hal::io[hal::reg::clkpsr])
+#define OCR0AL (hal::io[hal::reg::ocr0al])
+#define OCR0BL (hal::io[hal::reg::ocr0bl])
+#define ICR0L (hal::io[hal::reg::icr0l])
+#define TCNT0L (hal::io[hal::reg::tcnt0l])
+#define USIDR (hal::io[hal::reg::usidr])
+#define USISR (hal::io[hal::reg::usisr])
+#define USICR (hal::io[hal::reg::usicr])
+#define CLKPR (hal::io[hal::reg::clkpr])
+
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define TXEN 3
+#define UDRE 5
+#define TXC 6
+#define USITC 0
+#define USICLK 1
+#define USICS0 2
+#define USICS1 3
+#define USIWM0 4
+#define USIWM1 5
+#define CLKPCE 7
+
+#define __AVR_TINY_PM_BASE_ADDRESS__ 0x4000
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t *>(addr))
+#define pgm_read_word(addr) (*reinterpret_cast<const uint16_t *>(addr))
+
+#define _delay_ms(ms) hal::delay_cycles(uint32_t((ms) * (F_CPU / 1000)))
+
+#define HAL_REGISTER(type, name, reg) thread_local type name
+#define HAL_REGISTER_LOCAL(type, name, reg) type name // the host glue of contra.cpp takes its address
+#define HAL_STATE thread_local
+#define HAL_SECTION(name)
+#define HAL_SEED(value) hal::seed(value)
+#define HAL_NOINIT = hal::seed(0)
+#define HAL_GAME_OVER(score) hal::game_over(score)
+#define HAL_PAGE_LOCAL alignas(256)
+#define HAL_DELAY_CYCLES(cycles) hal::machine.tick(cycles)
+
+#ifdef CLOCK_PROFILE
+#define HAL_CLOCK_INIT() do { CLKPR = 1 << CLKPCE; CLKPR = CLOCK_PROFILE; } while (0) // what clock_prescale_set writes
+#else
+#define HAL_CLOCK_INIT() do {} while (0)
+#endif
+
+// AVR only attributes and the entry point: the game's 'void main()' is started by the runner
+//
+#define naked
+#define main hal_main
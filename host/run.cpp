@@ -0,0 +1,549 @@
+//
+// Native build of a game on the host HAL: runs instances of the game headless and prints their statistics
+//
+//   g++ -std=c++14 -O2 -pthread -DHAL_HOST -DGAME_SOURCE='"racing.cpp"' -I. host/run.cpp host/hal.cpp -o racing_host
+//   ./racing_host [frames] [seed] [instances] [threads] [--dump dir] [--hash file] [--check file]
+//                 [--phases file] [--vcd file]
+//
+// Defaults: 1000 frames, seed 1, one instance, a thread per core. An unknown option or a count that isn't a number
+// prints the usage and exits with 2.
+//
+// Instance i plays 'frames' frames with seed 'seed + i': the seed scripts the buttons and replaces the 'random'
+// initial values of the game (HAL_SEED, HAL_NOINIT), seed 0 keeps the firmware ones. Instances run in parallel,
+// each in a fresh thread so it starts from power-on state, and the results don't depend on the thread count.
+//
+// Golden frames: every frame's GDDRAM is hashed. --hash writes the hashes ('seed frame hash' lines), --check
+// compares them with such a file and fails on the first differing frame of every seed, --dump writes the frames
+// as PBM images (dir/<seed>/<frame>.pbm, the directories are created, lit pixels are black) to look at the difference:
+//
+//   ./racing_host 500 1 64 --hash racing.golden      # before a drawing optimization
+//   ./racing_host 500 1 64 --check racing.golden     # after it, exit code 1 on a pixel change
+//   ./racing_host 500 7 1 --dump frames              # frames of seed 7, before and after
+//
+// host/golden has the reviewed hashes of every game, 'make check' runs the --check of all three.
+//
+// Phase marks: a game built with -DPHASE_TRACE pulses its spare pin at the start of every phase (see HAL_PHASE),
+// beatem has none and builds without marks. --phases writes the edges of the pin in the first instance as
+// 'seconds,level' lines of virtual time, the format of a logic analyzer's CSV export, for tools/phase_report.py. The
+// time is the host estimate (see hal::Machine::cycles):
+//
+//   g++ ... -DPHASE_TRACE -DGAME_SOURCE='"racing.cpp"' ... -o racing_phases
+//   ./racing_phases 500 1 1 --phases racing.csv && tools/phase_report.py --game racing racing.csv
+//
+// Bus waveform: --vcd writes the display lines of the first instance (RES, DC, DIN, CLK, see hal::lines) and the
+// writes to UDR and UBRR of the USART game as a VCD file, time stamped by the virtual cycle counter. PHASE is the
+// phase pin of a -DPHASE_TRACE build. tools/bus_report.py summarizes it, GTKWave shows it:
+//
+//   ./contra_host 200 1 1 --vcd contra.vcd && tools/bus_report.py contra.vcd
+//
+
+#include GAME_SOURCE
+
+#undef main
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+
+struct Instance {
+    uint32_t frames;
+    uint64_t cycles;
+    uint32_t bytes;
+    uint32_t command_bytes;
+    uint32_t frame_bytes_max;
+    uint64_t tx_stall;
+    uint64_t tx_drain_stall;
+    std::vector<uint32_t> scores;    // per lost game
+    std::vector<uint32_t> durations; // frames per lost game
+    std::vector<uint64_t> hashes;    // per frame
+    FILE *phases;                    // trace of the phase pin or null
+    uint8_t phase_level;
+    FILE *vcd;                       // bus waveform or null
+    uint8_t vcd_lines;               // hal::lines and VCD_PHASE last written
+    uint64_t vcd_time;
+};
+
+static const uint8_t VCD_PHASE = 1 << 4;
+
+static const struct {
+    uint8_t line;
+    char code;
+    const char *name;
+} VCD_WIRES[] = {
+    { hal::LINE_RES, 'r', "RES" }, { hal::LINE_DC, 'd', "DC" }, { hal::LINE_DIN, 'i', "DIN" },
+    { hal::LINE_CLK, 'c', "CLK" }, { VCD_PHASE, 'p', "PHASE" },
+};
+
+static const char *dump_dir;
+
+// new buttons every 8 frames, or every 200000 cycles while the game waits for a button without drawing
+//
+static uint8_t script(hal::Machine &m, uint8_t port) {
+    uint32_t x = m.seed * 0x9E3779B9u + (m.frames / 8) * 0x85EBCA6Bu + uint32_t((m.cycles - m.frame_start) / 200000);
+
+    x ^= x >> 16; // murmur3 finalizer: every bit of the seed reaches the buttons
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+
+    if (port == 0) { // attiny104: buttons on PA3..PA5 pull the pins down
+        return ~((x >> 8) & 0b111) << 3;
+    }
+
+    return (x >> 8) & 0b1; // attiny13a: button on PB0 pulls the pin up
+}
+
+static void game_over(hal::Machine &m, uint32_t score) {
+    Instance &result = *static_cast<Instance *>(m.user);
+
+    result.scores.push_back(score);
+    result.durations.push_back(m.frames - m.game_start);
+}
+
+// FNV-1a of the display memory
+//
+static uint64_t frame_hash(const hal::Display &display) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (size_t i = 0; i < sizeof(display.ram); i++) {
+        hash = (hash ^ (&display.ram[0][0])[i]) * 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+// creates the directory and its missing parents (mkdir -p), false when one can't be created
+//
+static bool make_dirs(const char *path) {
+    char parent[256];
+    struct stat info;
+
+    if (!stat(path, &info)) {
+        errno = ENOTDIR;
+        return S_ISDIR(info.st_mode);
+    }
+
+    snprintf(parent, sizeof(parent), "%s", path);
+
+    if (char *slash = strrchr(parent, '/')) {
+        while (slash > parent && slash[-1] == '/') {
+            slash--;
+        }
+        *slash = 0;
+
+        if (*parent && !make_dirs(parent)) {
+            return false;
+        }
+    }
+
+    return !mkdir(path, 0777) || errno == EEXIST;
+}
+
+static void dump_frame(const hal::Machine &m) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%u/%05u.pbm", dump_dir, m.seed, m.frames);
+
+    FILE *file = fopen(path, "wb");
+
+    if (!file) {
+        printf("can't write %s\n", path);
+        return;
+    }
+
+    fprintf(file, "P4\n128 64\n");
+
+    for (uint8_t y = 0; y < 64; y++) {
+        for (uint8_t x = 0; x < 128; x += 8) {
+            uint8_t bits = 0;
+
+            for (uint8_t i = 0; i < 8; i++) {
+                bits = (bits << 1) | m.display.pixel(x + i, y);
+            }
+
+            fputc(bits, file);
+        }
+    }
+
+    fclose(file);
+}
+
+static void frame(hal::Machine &m) {
+    static_cast<Instance *>(m.user)->hashes.push_back(frame_hash(m.display));
+
+    if (dump_dir) {
+        dump_frame(m);
+    }
+}
+
+static void vcd_header(Instance &result, uint32_t seed) {
+    FILE *file = result.vcd;
+
+    fprintf(file, "$comment %s seed %u $end\n$comment clock %lu Hz $end\n$timescale 1 ps $end\n", GAME_SOURCE, seed,
+        (unsigned long)F_CPU);
+    fprintf(file, "$scope module display $end\n");
+
+    for (const auto &wire : VCD_WIRES) {
+        fprintf(file, "$var wire 1 %c %s $end\n", wire.code, wire.name);
+    }
+
+    fprintf(file, "$var wire 8 u UDR $end\n$var wire 8 b UBRR $end\n$upscope $end\n$enddefinitions $end\n");
+    fprintf(file, "#0\n$dumpvars\n0r\n0d\n0i\n0c\n0p\nb0 u\nb0 b\n$end\n");
+}
+
+static void vcd_value(FILE *file, uint8_t value, char code) {
+    char bits[9];
+
+    for (uint8_t i = 0; i < 8; i++) {
+        bits[i] = '0' + ((value >> (7 - i)) & 1);
+    }
+
+    bits[8] = 0;
+    fprintf(file, "b%s %c\n", bits, code);
+}
+
+// the lines after a register write, UDR and UBRR writes are recorded even if the value is the same
+//
+static void vcd_change(Instance &result, const hal::Machine &m, uint8_t id, uint8_t value, uint8_t lines) {
+    bool written = id == hal::reg::udr || id == hal::reg::ubrrl;
+
+    if (lines == result.vcd_lines && !written) {
+        return;
+    }
+
+    uint64_t time = m.cycles / F_CPU * 1000000000000ull + m.cycles % F_CPU * 1000000000000ull / F_CPU; // ps
+
+    if (time != result.vcd_time) {
+        fprintf(result.vcd, "#%llu\n", (unsigned long long)time);
+        result.vcd_time = time;
+    }
+
+    for (const auto &wire : VCD_WIRES) {
+        if ((lines ^ result.vcd_lines) & wire.line) {
+            fprintf(result.vcd, "%c%c\n", lines & wire.line ? '1' : '0', wire.code);
+        }
+    }
+
+    if (written) {
+        vcd_value(result.vcd, value, id == hal::reg::udr ? 'u' : 'b');
+    }
+
+    result.vcd_lines = lines;
+}
+
+static void trace_io(hal::Machine &m, uint8_t id, uint8_t value) {
+    Instance &result = *static_cast<Instance *>(m.user);
+    uint8_t phase = 0;
+
+#if defined(PHASE_TRACE) && defined(PHASE_PORT) // beatem has no spare pin
+    phase = (m.io[&PHASE_PORT - hal::io] >> PHASE_BIT) & 1;
+
+    if (result.phases && phase != result.phase_level) {
+        fprintf(result.phases, "%.9f,%u\n", double(m.cycles) / F_CPU, phase);
+        result.phase_level = phase;
+    }
+#endif
+
+    if (result.vcd) {
+        vcd_change(result, m, id, value, hal::lines() | (phase ? VCD_PHASE : 0));
+    }
+}
+
+static void simulate(Instance &result, uint32_t frames, uint32_t seed) {
+    hal::Machine &m = hal::machine;
+
+    m.reset();
+    m.frames_limit = frames;
+    m.cycles_limit = uint64_t(frames) * 1000000;
+    m.seed = seed;
+    m.input = script;
+    m.on_game_over = game_over;
+    m.on_frame = frame;
+    m.user = &result;
+
+    if (result.phases || result.vcd) {
+        m.on_io = trace_io;
+    }
+    if (result.vcd) {
+        vcd_header(result, seed);
+    }
+
+    try {
+        while (true) {
+            try {
+                hal_main();
+            }
+            catch (hal::restart &) {
+            }
+        }
+    }
+    catch (hal::stop &) {
+    }
+
+    result.frames = m.frames;
+    result.cycles = m.cycles;
+    result.bytes = m.bytes;
+    result.command_bytes = m.command_bytes;
+    result.frame_bytes_max = m.frame_bytes_max;
+    result.tx_stall = m.tx_stall;
+    result.tx_drain_stall = m.tx_drain_stall;
+}
+
+static void print_distribution(const char *name, std::vector<uint32_t> values) {
+    if (values.empty()) {
+        printf("%-16s -\n", name);
+        return;
+    }
+
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+
+    printf("%-16s min %u, p10 %u, median %u, p90 %u, max %u\n", name,
+        values[0], values[n / 10], values[n / 2], values[n * 9 / 10], values[n - 1]);
+}
+
+// compares the frames with 'seed frame hash' lines of the golden file, returns the number of differing seeds
+//
+static uint32_t check_hashes(const std::vector<Instance> &instances, uint32_t seed, const char *path) {
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        printf("can't read %s\n", path);
+        return 1;
+    }
+
+    std::map<std::pair<uint32_t, uint32_t>, uint64_t> golden;
+    unsigned golden_seed, golden_frame;
+    unsigned long long hash;
+
+    while (fscanf(file, "%u %u %llx", &golden_seed, &golden_frame, &hash) == 3) {
+        golden[{golden_seed, golden_frame}] = hash;
+    }
+
+    fclose(file);
+
+    uint32_t failed = 0;
+
+    for (uint32_t i = 0; i < instances.size(); i++) {
+        const std::vector<uint64_t> &hashes = instances[i].hashes;
+
+        for (uint32_t f = 0; f < hashes.size() || golden.count({seed + i, f + 1}); f++) {
+            auto it = golden.find({seed + i, f + 1});
+
+            if (f == hashes.size()) { // the run stopped drawing earlier than the golden one
+                printf("seed %u: frame %u wasn't drawn\n", seed + i, f + 1);
+                failed++;
+                break;
+            }
+            if (it == golden.end() || it->second != hashes[f]) {
+                printf("seed %u: frame %u %s\n", seed + i, f + 1, it == golden.end() ? "is missing" : "differs");
+                failed++;
+                break;
+            }
+        }
+    }
+
+    return failed;
+}
+
+static void usage(const char *name) {
+    printf("usage: %s [frames] [seed] [instances] [threads] [--dump dir] [--hash file] [--check file]\n"
+           "       [--phases file] [--vcd file]\n", name);
+}
+
+static bool parse_count(const char *text, uint32_t &value) { // decimal, 0x hex or 0 octal, nothing else
+    char *end;
+    errno = 0;
+    unsigned long long result = strtoull(text, &end, 0);
+
+    if (!isdigit((unsigned char)text[0]) || *end || errno || result > UINT32_MAX) {
+        return false;
+    }
+
+    value = uint32_t(result);
+    return true;
+}
+
+static bool write_hashes(const std::vector<Instance> &instances, uint32_t seed, const char *path) {
+    FILE *file = fopen(path, "w");
+
+    if (!file) {
+        printf("can't write %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    for (uint32_t i = 0; i < instances.size(); i++) {
+        for (uint32_t f = 0; f < instances[i].hashes.size(); f++) {
+            fprintf(file, "%u %u %016llx\n", seed + i, f + 1, (unsigned long long)instances[i].hashes[f]);
+        }
+    }
+
+    bool failed = ferror(file);
+
+    if (fclose(file) || failed) {
+        printf("can't write %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    std::vector<const char *> args;
+    const char *hash_path = nullptr;
+    const char *check_path = nullptr;
+    const char *phases_path = nullptr;
+    const char *vcd_path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        const char **value = !strcmp(argv[i], "--dump") ? &dump_dir :
+                             !strcmp(argv[i], "--hash") ? &hash_path :
+                             !strcmp(argv[i], "--check") ? &check_path :
+                             !strcmp(argv[i], "--phases") ? &phases_path :
+                             !strcmp(argv[i], "--vcd") ? &vcd_path : nullptr;
+
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (value && i + 1 < argc) {
+            *value = argv[++i];
+        }
+        else if (value || argv[i][0] == '-') {
+            printf("%s: %s %s\n", argv[0], value ? "missing value of" : "unknown option", argv[i]);
+            usage(argv[0]);
+            return 2;
+        }
+        else {
+            args.push_back(argv[i]);
+        }
+    }
+
+    uint32_t numbers[] = { 1000, 1, 1, std::thread::hardware_concurrency() }; // frames, seed, instances, threads
+
+    if (args.size() > sizeof(numbers) / sizeof(numbers[0])) {
+        printf("%s: too many arguments\n", argv[0]);
+        usage(argv[0]);
+        return 2;
+    }
+    for (size_t i = 0; i < args.size(); i++) {
+        if (!parse_count(args[i], numbers[i])) {
+            printf("%s: %s isn't a number\n", argv[0], args[i]);
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    uint32_t frames = numbers[0];
+    uint32_t seed = numbers[1];
+    uint32_t count = numbers[2];
+    uint32_t threads = numbers[3];
+
+    std::vector<Instance> instances(count);
+
+    if (phases_path && count) {
+#if defined(PHASE_TRACE) && defined(PHASE_PORT)
+        if (!(instances[0].phases = fopen(phases_path, "w"))) {
+            printf("can't write %s\n", phases_path);
+            return 1;
+        }
+
+        fprintf(instances[0].phases, "time,phase\n");
+#else
+        printf("--phases needs a build with -DPHASE_TRACE of a game with a phase pin (PHASE_PORT)\n");
+        return 1;
+#endif
+    }
+    if (vcd_path && count && !(instances[0].vcd = fopen(vcd_path, "w"))) {
+        printf("can't write %s\n", vcd_path);
+        return 1;
+    }
+    for (uint32_t i = 0; dump_dir && i < count; i++) { // the frames go to dir/<seed>/
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%u", dump_dir, seed + i);
+
+        if (!make_dirs(path)) {
+            printf("can't create %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+    }
+    std::vector<std::thread> workers;
+    std::atomic<uint32_t> next(0);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < std::max(1u, std::min(threads, count)); i++) {
+        workers.emplace_back([&]() {
+            for (uint32_t index; (index = next++) < count;) {
+                std::thread([&, index]() { // fresh thread local game globals
+                    simulate(instances[index], frames, seed + index);
+                }).join();
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    if (count && instances[0].phases) {
+        fclose(instances[0].phases);
+    }
+    if (count && instances[0].vcd) {
+        fclose(instances[0].vcd);
+    }
+
+    uint64_t total_frames = 0, total_cycles = 0, total_bytes = 0, total_commands = 0, total_stall = 0, total_drain = 0;
+    uint32_t bytes_max = 0;
+    std::vector<uint32_t> bytes_per_frame, scores, durations;
+
+    for (const Instance &result : instances) {
+        total_frames += result.frames;
+        total_cycles += result.cycles;
+        total_bytes += result.bytes;
+        total_commands += result.command_bytes;
+        total_stall += result.tx_stall;
+        total_drain += result.tx_drain_stall;
+        bytes_max = std::max(bytes_max, result.frame_bytes_max);
+        bytes_per_frame.push_back(result.bytes / std::max(1u, result.frames));
+        scores.insert(scores.end(), result.scores.begin(), result.scores.end());
+        durations.insert(durations.end(), result.durations.begin(), result.durations.end());
+    }
+
+    uint64_t done = std::max<uint64_t>(1, total_frames);
+
+    printf("instances        %u (seeds %u..%u)\n", count, seed, seed + count - 1);
+    printf("frames           %llu\n", (unsigned long long)total_frames);
+    printf("host ns/frame    %.0f\n", ns / done);
+    printf("cycles/frame     %llu\n", (unsigned long long)(total_cycles / done));
+    printf("bytes/frame      %llu (max %u)\n", (unsigned long long)(total_bytes / done), bytes_max);
+    print_distribution("bytes/frame run", bytes_per_frame);
+    printf("commands/frame   %llu bytes\n", (unsigned long long)(total_commands / done));
+    printf("tx stall/frame   %llu cycles (%llu waiting for TXC)\n",
+        (unsigned long long)(total_stall / done), (unsigned long long)(total_drain / done));
+    printf("games lost       %zu\n", scores.size());
+    print_distribution("score", scores);
+    print_distribution("frames to death", durations);
+
+    if (hash_path && !write_hashes(instances, seed, hash_path)) {
+        return 1;
+    }
+    if (check_path) {
+        uint32_t failed = check_hashes(instances, seed, check_path);
+        printf("golden frames    %s (%u of %u seeds differ)\n", failed ? "FAILED" : "ok", failed, count);
+
+        return failed ? 1 : 0;
+    }
+
+    return 0;
+}
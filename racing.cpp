@@ -7,23 +7,57 @@
 //
 // link flags: -nostartfiles --gc-sections -mmcu=attiny13a -mrelax
 //
+// attiny25/45/85 with USI: -mmcu=attiny85 -DOLED1306_USI (display wired to the USI pins, see below)
+// faster clock: -DCLOCK_PROFILE=0 (9.6MHz) or 1 (4.8MHz), the game keeps its speed (see FRAME_TIME)
+// phase marks: -DPHASE_TRACE -DPHASE_TRACE_RESET_PIN (see PHASE_BIT, tools/phase_report.py)
+//
 
+#ifdef CLOCK_PROFILE
+#define F_CPU (HAL_CLOCK_OSC >> CLOCK_PROFILE)
+#else
 // default attiny13a fuses = 1MHz
 #define F_CPU 1000000L
+#endif
 
-#include <avr/io.h>
-#include <util/delay.h>
+#include "hal.h"
+#include "font.h"
+#include "cost.h"
 
 // 4-wire connection to oled1306 display
 //
+#ifdef OLED1306_USI // attiny25/45/85 (-DOLED1306_USI): USI three-wire mode shifts data out of DO clocked by USCK
+#define D_DIN PORTB1 // D1 (DO)
+#define D_CLK PORTB2 // D0 (USCK)
+#define D_DC  PORTB3
+#define D_RES PORTB4
+#else
 #define D_DIN PORTB3 // D1
 #define D_CLK PORTB4 // D0
 #define D_DC  PORTB2
 #define D_RES PORTB1
+#endif
+
+// phase marks of the instrumentation build go to PB5, the only pin left: it's RESET, so the RSTDISBL fuse has to be
+// programmed (high voltage programming after that, the chip can't be flashed over ISP any more). The AVR build asks
+// for -DPHASE_TRACE_RESET_PIN to say that's intended. Phases: 1 road line, 2 car, 3 barriers, 4 score and road turn,
+// 5 delay, 6 restart (game over, title screen)
+//
+#if defined(PHASE_TRACE) && !defined(PHASE_TRACE_RESET_PIN) && !defined(HAL_HOST)
+#error "racing marks phases on PB5 (RESET, needs the RSTDISBL fuse): add -DPHASE_TRACE_RESET_PIN to build it anyway"
+#endif
+
+#define PHASE_PORT PORTB
+#define PHASE_BIT PORTB5
 
 #define OLED1306_PORT_HI(p) (PORTB |= (1 << (p)))
 #define OLED1306_PORT_LO(p) (PORTB &= ~(1 << (p)))
 
+#ifdef OLED1306_USI
+#define OLED1306_CLK_PULSE() (USICR = (1 << USIWM0) | (1 << USITC), USICR = (1 << USIWM0) | (1 << USITC)) // USIDR isn't shifted
+#else
+#define OLED1306_CLK_PULSE() (OLED1306_PORT_HI(D_CLK), OLED1306_PORT_LO(D_CLK))
+#endif
+
 template <uint8_t... Chars> struct chars {
 private:
     template <void (*f)(uint8_t), typename = void> inline static void _apply() {}
@@ -39,6 +73,8 @@ private:
     }
         
 public:
+    static constexpr uint8_t size = sizeof...(Chars); // bytes sent by apply, see cost.h
+
     template <void (*f)(uint8_t)> static void apply() {
         _apply<f, Chars...>();
     }
@@ -48,6 +84,28 @@ public:
     }
 };
 
+#ifdef OLED1306_USI
+// every USICR write toggles USCK, the second one of a pair also shifts USIDR: 2 cycles per bit instead of ~13
+//
+static const uint16_t SEND_CYCLES = 28; // per byte with call and D/C
+static const uint16_t REPEAT_CYCLES = 20; // per byte of send_repeat with 0x00 or 0xFF
+static void send_value(uint8_t value) {
+    const uint8_t clk_rise = (1 << USIWM0) | (1 << USITC);
+    const uint8_t clk_fall = (1 << USIWM0) | (1 << USITC) | (1 << USICLK);
+
+    USIDR = value;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+    USICR = clk_rise; USICR = clk_fall;
+}
+#else
+static const uint16_t SEND_CYCLES = 115; // per byte with call and D/C, ~13 per bit
+static const uint16_t REPEAT_CYCLES = 36; // per byte of send_repeat with 0x00 or 0xFF
 static void send_value(uint8_t value) {
     OLED1306_PORT_LO(D_CLK);
             
@@ -64,6 +122,7 @@ static void send_value(uint8_t value) {
         OLED1306_PORT_LO(D_CLK);
     }
 }
+#endif
     
 static void __attribute__ ((noinline)) send_command(uint8_t cmd) {
     OLED1306_PORT_LO(D_DC);
@@ -75,6 +134,38 @@ static void __attribute__ ((noinline)) send_data(uint8_t dat) {
     send_value(dat);
 }
 
+// run of one data byte: D/C is set once, for 0x00 and 0xFF the data line doesn't change either and a byte is 8 clock
+// pulses only (bit-bang: ~36 cycles per byte instead of ~115 for send_data in a loop, other values ~105)
+//
+static void send_repeat(uint8_t value, uint16_t count) {
+    OLED1306_PORT_HI(D_DC);
+
+    if (uint8_t(value + 1) > 1) { // not uniform bits
+        do {
+            send_value(value);
+        }
+        while (--count);
+
+        return;
+    }
+
+#ifdef OLED1306_USI
+    USIDR = value;
+#else
+    OLED1306_PORT_LO(D_DIN);
+
+    if (value) {
+        OLED1306_PORT_HI(D_DIN);
+    }
+#endif
+
+    do {
+        OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE();
+        OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE(); OLED1306_CLK_PULSE();
+    }
+    while (--count);
+}
+
 static void set_page(uint8_t page) {
     send_command(0x22);
     send_command(page);
@@ -93,16 +184,31 @@ static void set_coord(uint8_t coord) {
     send_command(127);
 }
 
+// addressing mode per drawing: horizontal for the windows above (clear, a column going down the pages), page mode
+// for sprites, where a page is 1 byte and a column 2 instead of 3 + 3 for a window
+//
+static const uint8_t ADDRESSING_HORIZONTAL = 0x00;
+static const uint8_t ADDRESSING_PAGE = 0x02;
+
+static void set_addressing(uint8_t mode) {
+    send_command(0x20);
+    send_command(mode);
+}
+
+static void goto_page(uint8_t page) {
+    send_command(0xB0 | page);
+}
+
+static void goto_column(uint8_t coord) {
+    send_command(coord & 0x0F);
+    send_command(0x10 | (coord >> 4));
+}
+
 static void clear() {
+    set_addressing(ADDRESSING_HORIZONTAL);
     set_page(0);
     set_coord(0);
-    
-    uint16_t i = 8 * 128;
-    
-    do {
-        send_data(0x00);
-    }
-    while (--i);
+    send_repeat(0x00, 8 * 128);
 }
 
 static void init() {
@@ -116,6 +222,10 @@ static void init() {
     while(--i);
     
     OLED1306_PORT_HI(D_RES);
+
+#ifdef OLED1306_USI
+    OLED1306_PORT_LO(D_CLK); // USCK idles low, strobes only toggle it
+#endif
     
     chars<0xAE, 0xD5, 0x80, 0xA8, 0x3f, 0x20, 0x00, 0xAF>::apply<send_command>();
 }
@@ -127,10 +237,35 @@ static const uint8_t CAR_LEFT_SIDE = 54;
 static const uint8_t CAR_RIGHT_SIDE = 62;
 static const uint8_t BARRIER_MIN_INDEX = 32;
 static const uint8_t BARRIER_DANGER_INDEX = 152;
-static const uint8_t BARRIER_STEP_1 = 64;
-static const uint8_t BARRIER_STEP_2 = 96;
-static const uint8_t BARRIER_STEP_4 = 176;
-static const uint8_t START_FRAME_TIME = 30;
+static const uint8_t BARRIER_MAX_INDEX = 176;
+static const uint8_t BARRIER_STEPS = 32;
+static const uint8_t ROAD_CENTER = 64;
+static const uint8_t ROAD_BOTTOM_PAGE = 5;
+static const uint8_t ROAD_LINE_PAGE = 3; // center line is a single column, it follows the curve of its middle
+static const uint8_t ROAD_EDGE_LEFT = 0b11000000; // first byte of an edge, the next ones are shifted by 2 bits
+static const uint8_t ROAD_EDGE_RIGHT = 0b00000011;
+static const uint8_t ROAD_CURVES = 3;
+static const uint8_t ROAD_STRAIGHT = 1;
+
+// barriers on the road at once (1, 2 or 4): they start BARRIER_SPACING apart, a quarter of the road at most. 4 don't
+// fit the frame budget at 1MHz with the bit-banged display (see frame_cost)
+//
+#ifndef BARRIERS_MAX
+#define BARRIERS_MAX 2
+#endif
+
+static_assert(BARRIERS_MAX == 1 || BARRIERS_MAX == 2 || BARRIERS_MAX == 4, "Barriers have to divide the road evenly");
+static_assert((BARRIER_MIN_INDEX >> 4) >= 2, "Barrier erase run would be empty");
+
+static const uint16_t BARRIER_SPACING = 256 / BARRIERS_MAX;
+static const uint8_t DANGER_LEFT = 0b01;
+static const uint8_t DANGER_RIGHT = 0b10;
+
+// barrier position on the road and its speed are 8.8 fixed point, position wraps when the barrier is passed
+//
+static const uint16_t START_SPEED = 0x02C0;
+static const uint16_t SPEED_INC = 0x0058 / BARRIERS_MAX;
+static const uint16_t MAX_SPEED = 0x0C00;
 
 using car_side = chars<
     0b00000000,
@@ -177,37 +312,14 @@ using car_over = chars<
     0b00010000
 >;
 
-static uint16_t roadline[4] = {
+static const uint16_t roadline[4] PROGMEM = {
     0b0011001101001010,
     0b0110011001010101,
     0b1100110010101010,
     0b1001100110110101,
 };
 
-static uint8_t numbers[20] = {
-    0x7C,
-    0x7C,
-    0x00,
-    0x7C,
-    0x74,
-    0x5C,
-    0x54,
-    0x7C,
-    0x1C,
-    0x78,
-    0x5C,
-    0x74,
-    0x78,
-    0x64,
-    0x64,
-    0x1C,
-    0x6C,
-    0x7C,
-    0x4C,
-    0x3C,
-};
-
-static uint8_t score_txt[17] = {
+static const uint8_t score_txt[17] PROGMEM = {
     0x00,
     0x28,
     0x00,
@@ -227,13 +339,143 @@ static uint8_t score_txt[17] = {
     0x5C,
 };
 
-void draw_score_num(uint8_t num) {
-    uint8_t *img = (uint8_t *)numbers + (num << 1);
-    send_data(*img++);
-    send_data(*img);
-    send_data(0x0);
+// barrier pool as struct-of-arrays, sides and liveness are bit masks kept in registers. It's the only SRAM data
+// (.noinit, set before the first frame): the 64 bytes are left to it and the stack, the score line has no buffer
+// (draw_score sends straight from flash and the font)
+//
+static HAL_STATE uint16_t barrier_position[BARRIERS_MAX] HAL_SECTION(".noinit");
+static HAL_STATE uint8_t barrier_x[BARRIERS_MAX] HAL_SECTION(".noinit");
+
+static void draw_score(uint8_t score_hi, uint8_t score) { // page addressing
+    goto_page(7);
+    goto_column(51);
+
+    uint8_t i = 16;
+    do {
+        send_data(pgm_read_byte(&score_txt[i]));
+    }
+    while (i--);
+
+    font::draw_digit<send_data, 2>(score_hi);
+    font::draw_number<send_data, 2>(score);
 }
 
+// compile-time tables in flash: m[i] = F(i)
+//
+template <uint8_t (*F)(uint8_t), uint8_t N, uint8_t... I> struct flash_table : flash_table<F, N - 1, N - 1, I...> {};
+template <uint8_t (*F)(uint8_t), uint8_t... I> struct flash_table<F, 0, I...> {
+    static const uint8_t m[sizeof...(I)];
+};
+template <uint8_t (*F)(uint8_t), uint8_t... I> const uint8_t flash_table<F, 0, I...>::m[sizeof...(I)] PROGMEM = { F(I)... };
+
+// barrier perspective: size is inversely proportional to the distance,
+// the eye is placed so the barrier grows 4 times faster near the car than at the horizon
+//
+constexpr uint8_t barrier_index_at(uint8_t step) {
+    return BARRIER_MIN_INDEX + (BARRIER_MAX_INDEX - BARRIER_MIN_INDEX) * step / (2 * (BARRIER_STEPS - 1) - step);
+}
+
+using barrier_perspective = flash_table<barrier_index_at, BARRIER_STEPS>;
+
+static uint8_t barrier_index_of(uint16_t position) {
+    return pgm_read_byte(&barrier_perspective::m[uint8_t(position >> 8) / (256 / BARRIER_STEPS)]);
+}
+
+// road column shift for [curve * 8 + page], curve is 0 (left), 1 (straight) or 2 (right).
+// Far pages are bent more, the bottom page (car) is never shifted
+//
+constexpr uint8_t road_shift_at(uint8_t index) {
+    return uint8_t(((index >> 3) - 1) * (ROAD_BOTTOM_PAGE + 1 - (index & 7)) * (ROAD_BOTTOM_PAGE + 1 - (index & 7)) / 3);
+}
+
+using road_shift = flash_table<road_shift_at, ROAD_CURVES * 8>;
+
+static uint8_t road_shift_of(uint8_t curve, uint8_t page) {
+    return pgm_read_byte(&road_shift::m[curve * 8 + page]);
+}
+
+// road edges are the same bytes on every page, only the column address start is moved by the curve (page addressing)
+//
+static void draw_road_edges(uint8_t curve, uint8_t mask) {
+    uint8_t page = ROAD_BOTTOM_PAGE;
+
+    do {
+        uint8_t shift = road_shift_of(curve, page);
+
+        goto_page(page);
+        goto_column(ROAD_CENTER - 4 - 4 * page + shift);
+
+        for (uint8_t dat = ROAD_EDGE_LEFT; dat; dat >>= 2) {
+            send_data(dat & mask);
+        }
+
+        goto_column(ROAD_CENTER + 4 * page + shift);
+
+        for (uint8_t dat = ROAD_EDGE_RIGHT; dat; dat <<= 2) {
+            send_data(dat & mask);
+        }
+    }
+    while (--page);
+}
+
+// bytes sent by the edge loops of draw_road_edges
+//
+constexpr uint8_t edge_bytes_shifted_right(uint8_t dat) {
+    return dat ? 1 + edge_bytes_shifted_right(dat >> 2) : 0;
+}
+
+constexpr uint8_t edge_bytes_shifted_left(uint8_t dat) {
+    return dat ? 1 + edge_bytes_shifted_left(uint8_t(dat << 2)) : 0;
+}
+
+// columns of the barrier summed over the perspective steps
+//
+constexpr uint16_t barrier_columns(uint8_t steps) {
+    return steps ? (barrier_index_at(steps - 1) >> 4) + barrier_columns(steps - 1) : 0;
+}
+
+// frames (see cost.h). Every frame draws the road line, the car and every barrier: a barrier is typically a run of
+// its average width on its page. The worst frame is the one a barrier passes in: the score is redrawn, the road
+// turns (edges erased and drawn on every page, line erased), and every barrier takes its slower branch, erased on its
+// old page then drawn, or one run over the old and new columns that share one at least
+//
+namespace frame_cost {
+    constexpr cost::Cost send(uint32_t count) {
+        return cost::bytes(count, SEND_CYCLES);
+    }
+
+    static const uint8_t BARRIER_WIDTH = BARRIER_MAX_INDEX >> 4; // columns of the nearest barrier (index >> 4)
+
+    constexpr cost::Cost addressing = send(2); // set_addressing
+    constexpr cost::Cost window = send(3); // set_page, set_coord_range
+    constexpr cost::Cost page = send(1); // goto_page
+    constexpr cost::Cost column = send(2); // goto_column
+
+    constexpr cost::Cost line = addressing + window + window + send(4) + addressing; // t0, 3 x t1 down the pages
+    constexpr cost::Cost car = page + column + send(cost::widest(car_side::size, car_center::size, car_over::size));
+    constexpr cost::Cost barrier = page + column + send(barrier_columns(BARRIER_STEPS) / BARRIER_STEPS);
+    constexpr cost::Cost barrier_worst = cost::slower(
+        page + column + cost::bytes(BARRIER_WIDTH - 1, REPEAT_CYCLES) + page + column + send(BARRIER_WIDTH - 1),
+        page + column + send(2 * BARRIER_WIDTH - 2));
+    constexpr cost::Cost score = page + column + send(sizeof(score_txt) + 3 * font::DIGIT_WIDTH);
+    constexpr cost::Cost road_edges = (page + column + send(edge_bytes_shifted_right(ROAD_EDGE_LEFT)) +
+        column + send(edge_bytes_shifted_left(ROAD_EDGE_RIGHT))) * ROAD_BOTTOM_PAGE;
+    constexpr cost::Cost turn = road_edges * 2 + line;
+
+    constexpr cost::Cost typical = line + car + barrier * BARRIERS_MAX;
+    constexpr cost::Cost worst = line + car + barrier_worst * BARRIERS_MAX + score + turn;
+}
+
+// ms of the pause, a faster clock adds the drawing time of a typical frame it saves
+//
+static const uint8_t FRAME_TIME = 20 + frame_cost::typical.cycles / 1000 - frame_cost::typical.cycles / (F_CPU / 1000);
+
+// at 1MHz with the bit-banged display 1, 2 and 4 barriers draw their worst frame in 26.2, 28.9 and 34.2ms of the
+// 28.5, 30.4 and 34.0ms budget: 4 barriers need the USI display or a faster clock
+//
+static_assert(frame_cost::worst.cycles <= cost::budget(FRAME_TIME, frame_cost::typical, F_CPU),
+    "Worst frame doesn't fit the drawing budget (4 barriers need -DOLED1306_USI or -DCLOCK_PROFILE)");
+
 void delay(uint16_t ms) {
     do {
         _delay_ms(1);
@@ -241,11 +483,11 @@ void delay(uint16_t ms) {
     while(--ms);
 }
 
-// Compiler will generate code that fill memory (22 bytes)
 void main() __attribute__((naked, section(".init9")));
 void main() {
+    HAL_CLOCK_INIT();
     
-    DDRB  = 0b00011110;
+    DDRB  = 0b00011110 | HAL_PHASE_MASK;
     PORTB = 0b00000001;
     
     init();
@@ -262,51 +504,48 @@ void main() {
 
         clear();
 
-        { // horizon
-            uint8_t fill = 128;
-            while(--fill) {
-                send_data(0x80);
-            }
-        }
+        send_repeat(0x80, 127); // horizon
         
-        set_coord(40);
-        for (uint8_t i = 5; i; i--) {
-            set_page(i);
-            chars<0b00000011, 0b00001100, 0b00110000, 0b11000000>::apply_inv<send_data>();
-        }
+        set_addressing(ADDRESSING_PAGE);
 
-        set_coord(68);
-        for (uint8_t i = 1; i < 6; i++) {
-            set_page(i);
-            chars<0b00000011, 0b00001100, 0b00110000, 0b11000000>::apply<send_data>();
-        }
+        uint8_t curve = ROAD_STRAIGHT;
+        draw_road_edges(curve, 0xFF);
         
         uint8_t car_current_offset = CAR_START_OFFSET;
         uint8_t car_max_offset = -CAR_MAX_OFFSET;
         uint8_t car_inc = -1;
 
-        uint8_t barrier_side = 0xD2; // rnd
-        uint8_t barrier_index = BARRIER_MIN_INDEX;
-        uint8_t barrier_page = 1;
-        uint8_t barrier_x = 0;
+        uint8_t barrier_side = HAL_SEED(0xD2); // rnd
+        uint8_t barrier_sides = barrier_side;
+        uint8_t barrier_live = 0b1; // the rest join when the first one is far enough
+        uint8_t danger = 0;
+        uint16_t speed = START_SPEED;
+
+        for (uint8_t i = 0; i < BARRIERS_MAX; i++) {
+            barrier_position[i] = 0;
+            barrier_x[i] = ROAD_CENTER; // nothing to erase there
+        }
 
         uint8_t roadline_index = 0;
         
-        uint8_t score0 = 0;
-        uint8_t score1 = 0;
-        uint8_t score2 = 0;
-        
-        uint8_t frame_time = START_FRAME_TIME;
+        uint8_t score = 0; // packed BCD of two low digits
+        uint8_t score_hi = 0;
+
+        draw_score(score_hi, score);
         
         while (true) {
-            delay(frame_time);
+            HAL_PHASE(5);
+            delay(FRAME_TIME);
             
-            set_coord_range(64, 64);
+            HAL_PHASE(1);
+            uint8_t line_x = ROAD_CENTER + road_shift_of(curve, ROAD_LINE_PAGE);
+            set_addressing(ADDRESSING_HORIZONTAL); // single column window goes down the pages
+            set_coord_range(line_x, line_x);
             set_page(2);
             
             { // center road line
-                uint8_t t0 = *(uint8_t *)&roadline[roadline_index];
-                uint8_t t1 = *((uint8_t *)&roadline[roadline_index] + 1);
+                uint8_t t0 = pgm_read_byte((const uint8_t *)&roadline[roadline_index]);
+                uint8_t t1 = pgm_read_byte((const uint8_t *)&roadline[roadline_index] + 1);
 
                 send_data(t0);
                 send_data(t1);
@@ -316,8 +555,12 @@ void main() {
                 if (++roadline_index >= 4) {
                     roadline_index = 0;
                 }
+
+                set_addressing(ADDRESSING_PAGE);
             }
 
+            HAL_PHASE(2);
+
             { // car
                 uint8_t tmp = CAR_CENTER + car_max_offset;
                 if (car_current_offset == tmp) {
@@ -331,11 +574,11 @@ void main() {
                 }
             }
 
-            set_page(5);
-            set_coord(car_current_offset);
+            goto_page(5);
+            goto_column(car_current_offset);
 
             if (car_current_offset < CAR_LEFT_SIDE) {
-                if ((barrier_side & 0x1) && barrier_index > BARRIER_DANGER_INDEX) {
+                if (danger & DANGER_LEFT) {
                     car_over::apply<send_data>();
                     break;
                 }
@@ -344,7 +587,7 @@ void main() {
                 }
             }
             else if (car_current_offset > CAR_RIGHT_SIDE) {
-                if ((barrier_side & 0x1) == 0 && barrier_index > BARRIER_DANGER_INDEX) {
+                if (danger & DANGER_RIGHT) {
                     car_over::apply<send_data>();
                     break;
                 }
@@ -356,74 +599,117 @@ void main() {
                 car_center::apply<send_data>();
             }
             
+            HAL_PHASE(3);
+
             { // barriers
-                set_page(barrier_page);
-                set_coord(barrier_x);
-                
-                {
-                    uint8_t draw_count = barrier_index >> 4;
-                    while (--draw_count) {
-                        send_data(0x0);
+                uint8_t page_set = 0xFF; // goto_page is skipped while runs stay on the same page
+                uint8_t bit = 0b1;
+
+                danger = 0;
+
+                for (uint8_t i = 0; i < BARRIERS_MAX; i++, bit <<= 1) {
+                    if ((barrier_live & bit) == 0) {
+                        if (uint8_t(barrier_position[0] >> 8) < i * BARRIER_SPACING) {
+                            continue;
+                        }
+
+                        barrier_live |= bit;
                     }
-                }
-                
-                if (barrier_index < BARRIER_STEP_1) {
-                    barrier_index += 1;
-                }
-                else if (barrier_index < BARRIER_STEP_2) {
-                    barrier_index += 2;
-                }
-                else if (barrier_index < BARRIER_STEP_4) {
-                    barrier_index += 4;
-                }
-                else {
-                    barrier_index = BARRIER_MIN_INDEX;
-                    barrier_side = (barrier_side << 1) | (barrier_side >> 7);
-                    
-                    if (frame_time > 1) {
-                        frame_time--;
+
+                    uint8_t old_count = barrier_index_of(barrier_position[i]) >> 4;
+                    uint8_t old_page = old_count >> 1;
+                    uint8_t old_x = barrier_x[i];
+
+                    uint16_t position = barrier_position[i] + speed;
+                    barrier_position[i] = position;
+
+                    if (position < speed) { // wrapped, barrier is passed
+                        barrier_side = (barrier_side << 1) | (barrier_side >> 7);
+                        barrier_sides = (barrier_sides & ~bit) | (barrier_side & bit);
+
+                        if (speed < MAX_SPEED) {
+                            speed += SPEED_INC;
+                        }
+
+                        HAL_PHASE(4);
+
+                        if (font::bcd_inc(score)) {
+                            score_hi++;
+                        }
+
+                        draw_score(score_hi, score); // score line is redrawn only when it changes
+
+                        uint8_t next_curve = (barrier_side >> 2) & 0b11;
+                        if (next_curve == ROAD_CURVES) {
+                            next_curve = ROAD_STRAIGHT;
+                        }
+
+                        if (next_curve != curve) {
+                            draw_road_edges(curve, 0x00);
+                            set_addressing(ADDRESSING_HORIZONTAL);
+                            set_coord_range(line_x, line_x);
+                            set_page(2);
+                            chars<0x00, 0x00, 0x00, 0x00>::apply<send_data>();
+                            set_addressing(ADDRESSING_PAGE);
+
+                            curve = next_curve;
+                            draw_road_edges(curve, 0xFF);
+                        }
+
+                        HAL_PHASE(3);
+                        page_set = 0xFF;
                     }
-                    
-                    if (++score0 >= 10) {
-                        score0 = 0;
-                        if (++score1 >= 10) {
-                            score1 = 0;
-                            score2++;
+
+                    uint8_t index = barrier_index_of(position);
+                    uint8_t offset = index >> 2;
+                    uint8_t draw_count = offset >> 2;
+                    uint8_t page = (draw_count >> 1);
+                    uint8_t left = barrier_sides & bit;
+
+                    uint8_t x = ROAD_CENTER + road_shift_of(curve, page) + (left ? (-draw_count - page) : (1 + page));
+                    barrier_x[i] = x;
+
+                    if (index > BARRIER_DANGER_INDEX) {
+                        danger |= left ? DANGER_LEFT : DANGER_RIGHT;
+                    }
+
+                    uint8_t end = x + draw_count - 1;
+                    uint8_t old_end = old_x + old_count - 1;
+
+                    if (page != old_page || old_end < x || end < old_x) { // erase on its own, the gap keeps the road
+                        if (old_page != page_set) {
+                            goto_page(old_page);
+                            page_set = old_page;
                         }
+
+                        goto_column(old_x);
+                        send_repeat(0x00, old_end - old_x); // at least 1, see BARRIER_MIN_INDEX
+
+                        old_x = x;
+                        old_end = end;
                     }
-                }
 
-                uint8_t offset = barrier_index >> 2;
-                uint8_t draw_count = offset >> 2;
-                uint8_t page = (draw_count >> 1);
-                
-                barrier_x = 64 + ((barrier_side & 0x1) ? (-draw_count - page) : (1 + page));
-                
-                set_page(page);
-                set_coord(barrier_x);
-                barrier_page = page;
+                    if (page != page_set) {
+                        goto_page(page);
+                        page_set = page;
+                    }
 
-                while (--draw_count) {
-                    send_data(0b00000001 << (offset & 7));
-                }
-            }
-            
-            set_page(7);
-            set_coord(51);
+                    // single run covers both erased and drawn columns when they overlap
+                    uint8_t column = old_x < x ? old_x : x;
+                    uint8_t last = old_end > end ? old_end : end;
+
+                    goto_column(column);
 
-            {
-                uint8_t i = 16;
-                do {
-                    send_data(score_txt[i]);
+                    while (column != last) {
+                        send_data((column >= x && column < end) ? (0b00000001 << (offset & 7)) : 0x0);
+                        column++;
+                    }
                 }
-                while (i--);
             }
-
-            draw_score_num(score2);
-            draw_score_num(score1);
-            draw_score_num(score0);
         }
-        
+
+        HAL_PHASE(6);
+        HAL_GAME_OVER(score_hi * 100 + (score >> 4) * 10 + (score & 0xF));
         delay(2500);
     }
 }
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+#
+# Display bus report for VCD waveforms of the host runner (host/run.cpp --vcd)
+#
+# Bit-banged and USI games: bytes are decoded from the rising edges of CLK while RES is high, D/C is sampled on the
+# eighth one. USART game: every write to UDR is a byte, it's shifted out when the previous one is done, in
+# 16 x (UBRR + 1) cycles. Bytes closer than the pause (frame delays, waiting for a button) form a burst.
+#
+# Reported: bytes with the command share, achieved bit rate over the bursts, fastest clock against the SSD1306 serial
+# clock limit, idle gaps between the bytes of a burst (from the end of a byte to the start of the next), per D/C
+# transition so the slow paths stand out (cmd>dat: a new position before the drawing).
+#
+# Usage:
+#   tools/bus_report.py contra.vcd
+#   tools/bus_report.py --pause 200 racing.vcd    # shorter pause (us) between bursts
+#
+# Exit code is 1 when the bus clock is faster than the display's limit.
+#
+
+import argparse
+import re
+import sys
+
+from phase_report import read_vcd_signals
+
+SSD1306_CLOCK = 10e6 # serial clock cycle time 100ns
+
+ORDER = {'RES': 0, 'DC': 1, 'DIN': 2, 'UBRR': 3, 'UDR': 4, 'CLK': 5} # lines set in the same cycle come before the strobes
+
+
+def events(signals):
+    """[(seconds, name, value), ...] of all the signals in time order"""
+    merged = [(time, ORDER.get(name, 9), name, value) for name, changes in signals.items() for time, value in changes]
+    merged.sort(key=lambda event: event[:2])
+
+    return [(time, name, value) for time, _, name, value in merged]
+
+
+def bitbang_bytes(signals, clock):
+    """[(start, end, is_data), ...] in cycles and the fastest clock period, bytes from the first to the eighth edge"""
+    lines = {'RES': 0, 'DC': 0, 'DIN': 0, 'CLK': 0}
+    result = []
+    period = None
+    count = 0
+    start = last = 0
+
+    for time, name, value in events(signals):
+        cycle = time * clock
+        rising = name == 'CLK' and value and not lines['CLK']
+        lines[name] = value
+
+        if name == 'RES' and not value:
+            count = 0
+        if not rising or not lines['RES']:
+            continue
+
+        if count == 0:
+            start = cycle
+        elif period is None or cycle - last < period:
+            period = cycle - last
+
+        last = cycle
+        count += 1
+
+        if count == 8:
+            result.append((start, cycle, lines['DC']))
+            count = 0
+
+    return result, period
+
+
+def usart_bytes(signals, clock):
+    """[(start, end, is_data), ...] in cycles and the clock period, bytes shifted out after their writes to UDR"""
+    lines = {'RES': 0, 'DC': 0, 'UBRR': 0}
+    result = []
+    done = 0
+
+    for time, name, value in events(signals):
+        if name != 'UDR':
+            lines[name] = value
+            continue
+
+        cycles = 16 * (lines['UBRR'] + 1)
+        start = max(time * clock, done)
+        done = start + cycles
+
+        if lines['RES']: # the display ignores the bus while it's in reset
+            result.append((start, done, lines['DC']))
+
+    return result, 2 * (lines['UBRR'] + 1)
+
+
+def print_distribution(name, values):
+    if not values:
+        print('%-16s -' % name)
+        return
+
+    values = sorted(values)
+    n = len(values)
+
+    print('%-16s min %.0f, p10 %.0f, median %.0f, p90 %.0f, max %.0f cycles (%d)' % (
+        name, values[0], values[n // 10], values[n // 2], values[n * 9 // 10], values[-1], n))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='display bus report for VCD waveforms of the host runner')
+    parser.add_argument('vcd', help='waveform written by host/run.cpp --vcd')
+    parser.add_argument('--clock', type=float, help='CPU clock in Hz (default: the one in the file, 1 MHz)')
+    parser.add_argument('--pause', type=float, default=1000, help='gap that ends a burst in us (default: 1000)')
+    args = parser.parse_args()
+
+    signals, comments = read_vcd_signals(open(args.vcd).read())
+    clock = args.clock
+
+    for comment in comments:
+        match = re.match(r'clock (\d+) Hz', comment)
+
+        if match and not clock:
+            clock = float(match.group(1))
+
+    clock = clock or 1e6
+
+    if any(value for _, value in signals.get('CLK', [])):
+        data, period = bitbang_bytes(signals, clock)
+        bus = 'CLK and DIN (bit-banged or USI)'
+    else:
+        data, period = usart_bytes(signals, clock)
+        bus = 'USART'
+
+    if not data:
+        print('no display bytes')
+        return 1
+
+    pause = args.pause * 1e-6 * clock
+    gaps = {}
+    busy = idle = 0.0
+    bursts = 1
+
+    for (start, end, is_data), (next_start, _, next_data) in zip(data, data[1:]):
+        gap = next_start - end
+
+        if gap > pause:
+            bursts += 1
+            continue
+
+        kind = '%s>%s' % ('dat' if is_data else 'cmd', 'dat' if next_data else 'cmd')
+        gaps.setdefault(kind, []).append(gap)
+        idle += gap
+
+    for start, end, _ in data:
+        busy += end - start
+
+    commands = sum(1 for _, _, is_data in data if not is_data)
+    rate = 8 * len(data) / ((busy + idle) / clock)
+    fastest = clock / period if period else 0
+
+    print('bus              %s, clock %.0f Hz' % (bus, clock))
+    print('bytes            %d (%d commands, %.1f%%), %d bursts' % (len(data), commands, 100.0 * commands / len(data), bursts))
+    print('bit rate         %.1f kbit/s over the bursts, %.1f%% of the time idle between bytes' % (
+        rate / 1000, 100.0 * idle / max(1, busy + idle)))
+    print('fastest clock    %.1f kHz, %.1f%% of the SSD1306 limit' % (fastest / 1000, 100.0 * fastest / SSD1306_CLOCK))
+    print_distribution('byte', [end - start for start, end, _ in data])
+
+    for kind in ('dat>dat', 'cmd>cmd', 'cmd>dat', 'dat>cmd'):
+        print_distribution('gap ' + kind, gaps.get(kind, []))
+
+    return 1 if fastest > SSD1306_CLOCK else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
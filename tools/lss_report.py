@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+#
+# Hot-loop report for avr-objdump listings (*.lss)
+#
+# Splits the hot functions of a listing into basic blocks, counts instructions and static cycles of every block
+# and compares the result with the committed listing. Static cycles are the fall-through cost: a branch is counted
+# as not taken, a skip as not skipping, calls aren't followed.
+#
+# Hot functions are given by their qualified names (spi::send_dat_sequence), a symbol matches when its name, mangled
+# or demangled (avr-objdump -C), is exactly that one.
+#
+# Usage:
+#   tools/lss_report.py contra.lss                                  # report of the listing
+#   tools/lss_report.py --elf contra.elf contra.lss                 # new listing to contra.new.lss, diff with contra.lss
+#   tools/lss_report.py --baseline old.lss contra.lss               # diff with any other listing
+#   tools/lss_report.py --elf contra.elf --max-text 0x400 contra.lss  # and fail when .text doesn't fit the flash
+#   tools/lss_report.py --objdump avr-objdump-7 --elf contra.elf contra.lss  # the tool (default: $AVR_OBJDUMP)
+#
+# The committed listing is never overwritten: once the new one is reviewed, it's copied over by hand (make lss). The
+# new listing interleaves the source (avr-objdump -h -S) so tools/pin_check.py can check it as well.
+#
+# Exit code is 1 when a hot function got slower or bigger than the baseline or .text is over --max-text, 2 when the
+# baseline or the size of .text can't be read, so it can gate a build.
+#
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+HOT_FUNCTIONS = ['spi::send_dat_sequence', 'spi::send_cmd_seq_3', 'game', 'draw_block']
+
+# cycles of the classic core (attiny13a), overrides for the reduced core (attiny104) below
+CYCLES = {
+    'adiw': 2, 'sbiw': 2, 'mul': 2, 'muls': 2, 'mulsu': 2, 'fmul': 2, 'fmuls': 2, 'fmulsu': 2, 'movw': 1,
+    'rjmp': 2, 'ijmp': 2, 'jmp': 3, 'rcall': 3, 'icall': 3, 'call': 4, 'ret': 4, 'reti': 4,
+    'ld': 2, 'ldd': 2, 'lds': 2, 'st': 2, 'std': 2, 'sts': 2, 'push': 2, 'pop': 2,
+    'lpm': 3, 'elpm': 3, 'spm': 4, 'sbi': 2, 'cbi': 2,
+}
+CYCLES_AVRRC = dict(CYCLES, rcall=4, icall=4, ld=1, lds=1, st=1, sts=1, sbi=1, cbi=1)
+
+ENDS_BLOCK = re.compile(r'^(br\w+|rjmp|ijmp|jmp|ret|reti|cpse|sbrc|sbrs|sbic|sbis)$')
+INSTRUCTION = re.compile(r'^\s*([0-9a-f]+):\t(?:[0-9a-f]{2} )+\s*\t(\w+)\t?([^;]*)(?:;\s*0x([0-9a-f]+))?')
+FUNCTION = re.compile(r'^([0-9a-f]{8}) <(.+)>:$')
+SECTION = re.compile(r'^\s*\d+\s+(\S+)\s+([0-9a-f]{8})\s', re.M)
+LENGTH = re.compile(r'\d+')
+
+
+def qualified_name(symbol):
+    """'_ZN3spi17send_dat_sequenceEhh' or 'spi::send_dat_sequence(unsigned char, unsigned char)' (demangled) ->
+    'spi::send_dat_sequence', C names stay as they are"""
+    if not symbol.startswith('_Z'):
+        return symbol.split('(')[0]
+
+    position = 3 if symbol.startswith('_ZN') else 2
+    parts = []
+
+    if symbol[position:position + 1] == 'L': # internal linkage
+        position += 1
+
+    while position < len(symbol) and symbol[position].isdigit():
+        digits = LENGTH.match(symbol, position).group(0)
+        position += len(digits)
+        parts.append(symbol[position:position + int(digits)])
+        position += int(digits)
+
+        if not symbol.startswith('_ZN'): # a single name, the rest is the parameters
+            break
+
+    return '::'.join(parts) if parts else symbol
+
+
+def parse(text):
+    """{function: [(address, mnemonic, operands, target), ...]}, data objects have no instructions"""
+    functions = {}
+    current = None
+
+    for line in text.splitlines():
+        match = FUNCTION.match(line)
+
+        if match:
+            current = functions.setdefault(match.group(2), [])
+            continue
+
+        match = INSTRUCTION.match(line)
+
+        if match and current is not None:
+            target = int(match.group(4), 16) if match.group(4) else None
+            current.append((int(match.group(1), 16), match.group(2), match.group(3).strip(), target))
+
+    return {name: code for name, code in functions.items() if code}
+
+
+def section_size(text, name):
+    """size of a section from the headers of the listing (avr-objdump -h), None if it's missing"""
+    for section, size in SECTION.findall(text):
+        if section == name:
+            return int(size, 16)
+
+    return None
+
+
+def new_listing_path(listing):
+    """contra.lss -> contra.new.lss"""
+    stem, dot, extension = listing.rpartition('.')
+    return '%s.new.%s' % (stem, extension) if dot else listing + '.new'
+
+
+def basic_blocks(code, cycles):
+    """[(address, instructions, static cycles)]"""
+    addresses = {address for address, _, _, _ in code}
+    leaders = {code[0][0]}
+
+    for index, (address, mnemonic, _, target) in enumerate(code):
+        if ENDS_BLOCK.match(mnemonic):
+            if index + 1 < len(code):
+                leaders.add(code[index + 1][0])
+            if target in addresses:
+                leaders.add(target)
+
+    blocks = []
+
+    for address, mnemonic, _, _ in code:
+        if address in leaders:
+            blocks.append([address, 0, 0])
+
+        blocks[-1][1] += 1
+        blocks[-1][2] += cycles.get(mnemonic, 1)
+
+    return [tuple(block) for block in blocks]
+
+
+def report(text, hot, cycles):
+    """{qualified name: blocks} of the 'hot' functions"""
+    functions = {qualified_name(name): code for name, code in parse(text).items()}
+    return {name: basic_blocks(code, cycles) for name, code in functions.items() if name in hot}
+
+
+def print_report(result):
+    for name, blocks in sorted(result.items()):
+        print('%-40s instr %4d  cycles %4d  blocks %3d' % (
+            name, sum(b[1] for b in blocks), sum(b[2] for b in blocks), len(blocks)))
+
+        for address, count, cost in blocks:
+            print('    0x%04x  instr %3d  cycles %3d' % (address, count, cost))
+
+
+def diff(base, current):
+    """prints changes, returns True if something got worse"""
+    worse = False
+
+    for name in sorted(set(base) | set(current)):
+        if name not in current:
+            print('%-40s removed' % name)
+            continue
+        if name not in base:
+            print('%-40s new' % name)
+            continue
+
+        old, new = base[name], current[name]
+        di = sum(b[1] for b in new) - sum(b[1] for b in old)
+        dc = sum(b[2] for b in new) - sum(b[2] for b in old)
+
+        if di or dc or len(old) != len(new):
+            print('%-40s instr %+4d  cycles %+4d  blocks %d -> %d' % (name, di, dc, len(old), len(new)))
+
+            for index, (a, b) in enumerate(zip(old, new)):
+                if a[1:] != b[1:]:
+                    print('    block %3d  0x%04x -> 0x%04x  instr %+3d  cycles %+3d' % (
+                        index, a[0], b[0], b[1] - a[1], b[2] - a[2]))
+
+        worse |= di > 0 or dc > 0
+
+    return worse
+
+
+def main():
+    parser = argparse.ArgumentParser(description='hot-loop report for avr-objdump listings')
+    parser.add_argument('listing', help='listing to analyse, the baseline if --elf is given')
+    parser.add_argument('--elf', help='regenerate the listing from this file with avr-objdump')
+    parser.add_argument('--output', help='regenerated listing (default: LISTING with .new before the extension)')
+    parser.add_argument('--baseline', help='baseline listing (default: LISTING when --elf is given)')
+    parser.add_argument('--max-text', type=lambda value: int(value, 0), help='flash size: fail when .text is bigger')
+    parser.add_argument('--function', action='append', help='qualified name of a hot function (repeatable)')
+    parser.add_argument('--objdump', default=os.environ.get('AVR_OBJDUMP', 'avr-objdump'),
+        help='objdump for the --elf listing (default: $AVR_OBJDUMP or avr-objdump)')
+    parser.add_argument('--classic', action='store_true', help='classic core cycles (default: reduced core)')
+    args = parser.parse_args()
+
+    hot = args.function or HOT_FUNCTIONS
+    cycles = CYCLES if args.classic else CYCLES_AVRRC
+    listing = args.listing
+    baseline = args.baseline or (listing if args.elf else None)
+
+    if args.elf:
+        listing = args.output or new_listing_path(args.listing)
+
+        try:
+            text = subprocess.run([args.objdump, '-h', '-S', args.elf], check=True, capture_output=True, text=True).stdout
+        except (OSError, subprocess.CalledProcessError) as error:
+            print('%s: %s' % (args.objdump, error))
+            return 2
+
+        with open(listing, 'w') as out:
+            out.write(text)
+
+    text = open(listing).read()
+    current = report(text, hot, cycles)
+    failed = False
+
+    if args.max_text is not None:
+        size = section_size(text, '.text')
+
+        if size is None:
+            print('%s: no .text section header (listing made without avr-objdump -h?)' % listing)
+            return 2
+
+        print('%-40s 0x%04x of 0x%04x bytes' % ('.text', size, args.max_text))
+        failed = size > args.max_text
+
+    if baseline is None:
+        print_report(current)
+        return 1 if failed else 0
+
+    try:
+        base = report(open(baseline).read(), hot, cycles)
+    except OSError as error:
+        print('baseline: %s' % error)
+        return 2
+
+    if not base:
+        print('baseline %s has none of the hot functions' % baseline)
+        return 2
+
+    return 1 if diff(base, current) or failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+#
+# Per-phase frame time report from a trace of the phase pin
+#
+# A game built with -DPHASE_TRACE pulses its spare pin high for n x 8 cycles at the start of phase n (HAL_PHASE in
+# hal.h), the phase lasts until the next mark. The trace is a logic analyzer's CSV export ('time,level' rows, time in
+# seconds, one row per change), the same written by the host runner (host/run.cpp --phases) or a VCD file (sigrok,
+# simulators). Frames start at phase 1, a phase that comes back within a frame is summed, a phase missing from a frame
+# is left out of that phase's distribution (not counted as 0 us). Frames that restart the game (game over or the next
+# level, with the title screen) are counted but left out of the distributions.
+#
+# Usage:
+#   tools/phase_report.py --game racing racing.csv                    # distribution and histogram per phase
+#   tools/phase_report.py --game contra --signal PHASE contra.vcd     # VCD signal by name (default: the first one)
+#   tools/phase_report.py --clock 9600000 --column 3 capture.csv      # clock of the build, channel column of the CSV
+#
+# Exit code is 1 when the trace has no complete frame or has pulses that aren't marks.
+#
+
+import argparse
+import math
+import sys
+
+# phase names and clock of the games, see their HAL_PHASE marks
+GAMES = {
+    'racing': (1000000, ['road line', 'car', 'barriers', 'score', 'delay', 'restart']),
+    'contra': (8388608, ['shots', 'player', 'map', 'enemies', 'delay', 'restart']),
+}
+
+RESTART = 6
+
+UNIT = 8 # HAL_PHASE_UNIT
+
+VCD_SCALE = {'s': 1.0, 'ms': 1e-3, 'us': 1e-6, 'ns': 1e-9, 'ps': 1e-12, 'fs': 1e-15}
+
+
+def read_csv(text, column):
+    """[(seconds, level), ...], rows that don't parse (headers) are skipped"""
+    edges = []
+
+    for line in text.splitlines():
+        fields = line.replace(';', ',').split(',')
+
+        try:
+            edges.append((float(fields[0]), int(float(fields[column])) & 1))
+        except (ValueError, IndexError):
+            continue
+
+    return edges
+
+
+def read_vcd_signals(text):
+    """({name: [(seconds, value), ...]} in declaration order, [comment, ...]), x and z read as 0"""
+    tokens = text.split()
+    scale = 1e-9
+    names = {} # id -> name
+    comments = []
+    i = 0
+
+    while i < len(tokens) and tokens[i] != '$enddefinitions':
+        if tokens[i] in ('$timescale', '$comment'):
+            end = tokens.index('$end', i)
+
+            if tokens[i] == '$comment':
+                comments.append(' '.join(tokens[i + 1:end]))
+            else:
+                value = ''.join(tokens[i + 1:end])
+                digits = value.rstrip('munpfs')
+                scale = float(digits or 1) * VCD_SCALE[value[len(digits):]]
+            i = end
+        elif tokens[i] == '$var':
+            names.setdefault(tokens[i + 3], tokens[i + 4])
+        i += 1
+
+    signals = {name: [] for name in names.values()}
+    time = 0
+    vector = None
+
+    for token in tokens[i:]:
+        if vector is not None: # 'b0101 id'
+            if token in names:
+                signals[names[token]].append((time * scale, vector))
+            vector = None
+        elif token.startswith('#'):
+            time = int(token[1:])
+        elif token[0] in 'bB':
+            vector = int(token[1:].replace('x', '0').replace('z', '0'), 2)
+        elif token[0] in '01xzXZ' and token[1:] in names:
+            signals[names[token[1:]]].append((time * scale, 1 if token[0] == '1' else 0))
+
+    return signals, comments
+
+
+def read_vcd(text, signal):
+    """[(seconds, level), ...] of a signal, the first one declared by default"""
+    signals = read_vcd_signals(text)[0]
+
+    if not signals:
+        raise ValueError('no signal in the VCD file')
+    if signal is None:
+        return next(iter(signals.values()))
+    if signal in signals:
+        return signals[signal]
+
+    raise ValueError('no signal %s in the VCD file (%s)' % (signal, ', '.join(signals)))
+
+
+def marks(edges, clock):
+    """[(seconds, phase), ...] of the rising edges with the width decoded, and the number of pulses that aren't marks"""
+    result = []
+    bad = 0
+    level = None
+    rise = None
+
+    for time, value in edges:
+        if value == level:
+            continue
+        if value:
+            rise = time
+        elif rise is not None:
+            phase = int(round((time - rise) * clock / UNIT))
+
+            if phase >= 1:
+                result.append((rise, phase))
+            else:
+                bad += 1
+
+        level = value
+
+    return result, bad
+
+
+def frames(phases):
+    """[{phase: seconds}, ...] of the complete frames (from a mark of phase 1 to the next one)"""
+    result = []
+    current = None
+
+    for (time, phase), (end, _) in zip(phases, phases[1:]):
+        if phase == 1:
+            if current is not None:
+                result.append(current)
+            current = {}
+        if current is not None:
+            current[phase] = current.get(phase, 0.0) + end - time
+
+    return result
+
+
+def print_distribution(name, values):
+    values = sorted(values)
+    n = len(values)
+
+    print('%-12s min %7.0f, p10 %7.0f, median %7.0f, p90 %7.0f, max %7.0f us' % (
+        name, values[0], values[n // 10], values[n // 2], values[n * 9 // 10], values[-1]))
+
+
+def print_histogram(values, bins):
+    """at most 'bins' bins of a whole number of us from the floor of the minimum, so no two start at the same label"""
+    low = math.floor(min(values))
+    step = int((max(values) - low) // bins) + 1
+    counts = [0] * (int((max(values) - low) // step) + 1)
+
+    for value in values:
+        counts[int((value - low) // step)] += 1
+
+    for b, count in enumerate(counts):
+        print('    %7d us %6d %s' % (low + b * step, count, '#' * (count * 50 // max(counts))))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='per-phase frame time report from a trace of the phase pin')
+    parser.add_argument('trace', help='CSV (time in seconds, level) or VCD file')
+    parser.add_argument('--game', choices=sorted(GAMES), help='phase names and clock of the game')
+    parser.add_argument('--clock', type=float, help='CPU clock of the build in Hz (default: the game\'s, 1 MHz)')
+    parser.add_argument('--column', type=int, default=1, help='CSV column of the phase pin (default: 1)')
+    parser.add_argument('--signal', help='VCD signal name of the phase pin (default: the first one)')
+    parser.add_argument('--bins', type=int, default=10, help='histogram bins (default: 10, 0: no histograms)')
+    args = parser.parse_args()
+
+    clock, names = GAMES.get(args.game, (1000000, []))
+    clock = args.clock or clock
+    text = open(args.trace).read()
+
+    try:
+        edges = read_vcd(text, args.signal) if text.lstrip().startswith('$') else read_csv(text, args.column)
+    except ValueError as error:
+        print(error)
+        return 1
+
+    phases, bad = marks(edges, clock)
+    result = frames(phases)
+    restarts = len(result)
+    result = [frame for frame in result if RESTART not in frame]
+    restarts -= len(result)
+
+    print('%d marks, %d frames (%d more restart the game), %d pulses that aren\'t marks' % (
+        len(phases), len(result), restarts, bad))
+
+    if not result:
+        return 1
+
+    for phase in sorted(set(p for frame in result for p in frame)):
+        name = names[phase - 1] if phase <= len(names) else 'phase %d' % phase
+        values = [frame[phase] * 1e6 for frame in result if phase in frame] # frames without the phase are skipped
+
+        print_distribution(name, values)
+
+        if len(values) < len(result):
+            print('%-12s in %d of %d frames' % ('', len(values), len(result)))
+
+        if args.bins:
+            print_histogram(values, args.bins)
+
+    print_distribution('frame', [sum(frame.values()) * 1e6 for frame in result])
+
+    return 1 if bad else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
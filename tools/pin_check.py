@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+#
+# Register pinning checker
+#
+# Globals bound to registers (register T name asm("rN") or HAL_REGISTER(T, name, "rN") at file scope) are found in the game source. An
+# instruction may write such a register only if the source line it was generated from mentions the variable, directly
+# or through a macro. Any other write (compiler temporaries, library helpers, prologue without matching push) is
+# reported, in the functions that use the variable as well.
+#
+# --zero-reg rN also reports every read of rN that doesn't come from a line using its variable: avr-gcc for the reduced
+# core assumes r17 is zero (stores, compares, copies, carry propagation), so pinning it (contra.cpp) is only safe while
+# nothing but the variable's own accesses read it.
+#
+# The listing has to interleave the source (avr-objdump -S of a build with -g, contra.new.lss of 'make lss'), the source
+# line of an instruction is the last one printed before it. tools/pin_check.sample.lss is a hand-made listing with
+# clobbered r16, r17 and r18, 'make pin-sample' compares the report with tools/pin_check.sample.txt.
+#
+# Usage:
+#   tools/pin_check.py contra.cpp contra.new.lss --zero-reg r17
+#   tools/pin_check.py beatem.cpp beatem.new.lss
+#
+# Exit code is 1 when a violation is found, 2 when the listing has no source lines.
+#
+
+import argparse
+import re
+import sys
+
+from lss_report import FUNCTION, INSTRUCTION
+
+PIN = re.compile(r'^(?:volatile\s+)?(?:register\s+(\w+)\s+(\w+)\s+asm\s*\(\s*"r(\d+)"\s*\)|'
+                 r'HAL_REGISTER\s*\(\s*(\w+)\s*,\s*(\w+)\s*,\s*"r(\d+)"\s*\))', re.M)
+BYTE_TYPES = {'uint8_t', 'int8_t', 'char', 'bool'}
+
+NO_WRITE = re.compile(r'^(st|std|sts|out|push|cp|cpc|cpi|cpse|tst|sbrc|sbrs|sbic|sbis|sbi|cbi|br\w+|rjmp|rcall|'
+                      r'jmp|call|ijmp|icall|ret|reti|nop|sleep|wdr|spm|bset|bclr|bst|se\w|cl\w)$')
+WORD_WRITE = {'movw', 'adiw', 'sbiw'}
+WRITE_ONLY = {'mov', 'movw', 'ldi', 'ld', 'ldd', 'lds', 'lpm', 'elpm', 'in', 'pop', 'ser', 'clr'}
+POINTERS = {'X': 26, 'Y': 28, 'Z': 30}
+
+
+def strip_comments(source):
+    return re.sub(r'//[^\n]*|/\*.*?\*/', '', source, flags=re.S)
+
+
+def pins(source):
+    """{register number: (variable, width)}"""
+    result = {}
+
+    for match in PIN.findall(source):
+        type_name, name, reg = match[:3] if match[0] else match[3:]
+        width = 1 if type_name in BYTE_TYPES else 2
+
+        for i in range(width):
+            result[int(reg) + i] = (name, width)
+
+    return result
+
+
+def aliases(source, variable):
+    """the variable and the macros that use it, directly or through other macros"""
+    source = strip_comments(source)
+    names = {variable}
+    macros = re.findall(r'^#define\s+(\w+)(.*(?:\\\n.*)*)', source, re.M)
+
+    changed = True
+    while changed:
+        changed = False
+
+        for macro, body in macros:
+            if macro not in names and names & set(re.findall(r'\w+', body)):
+                names.add(macro)
+                changed = True
+
+    return names
+
+
+def parse_source(text):
+    """{function: [(address, mnemonic, operands, {source words}), ...]} of a listing interleaved with the source"""
+    functions = {}
+    current = None
+    words = set()
+    lines = []
+
+    for line in text.splitlines():
+        match = FUNCTION.match(line)
+
+        if match:
+            current = functions.setdefault(match.group(2), [])
+            words, lines = set(), []
+            continue
+
+        match = INSTRUCTION.match(line)
+
+        if match:
+            if lines: # source printed since the previous instruction
+                words = set(re.findall(r'\w+', strip_comments('\n'.join(lines))))
+                lines = []
+            if current is not None:
+                current.append((int(match.group(1), 16), match.group(2), match.group(3).strip(), words))
+        elif current is not None and line.strip() and not re.match(r'^\s*\.\.\.$', line):
+            lines.append(line)
+
+    return {name: code for name, code in functions.items() if code}
+
+
+def registers(operand):
+    operand = operand.strip()
+
+    if re.fullmatch(r'r\d+', operand):
+        return [int(operand[1:])]
+
+    pointer = re.fullmatch(r'-?([XYZ])(\+\d*)?', operand)
+
+    if pointer:
+        return [POINTERS[pointer.group(1)], POINTERS[pointer.group(1)] + 1]
+
+    return []
+
+
+def access(mnemonic, operands):
+    """(written registers, read registers) of the instruction"""
+    args = [a for a in operands.split(',') if a.strip()]
+    written, read = set(), set()
+
+    for i, arg in enumerate(args):
+        read.update(registers(arg))
+
+    if mnemonic in ('lpm', 'elpm') and not args:
+        written.add(0)
+    elif mnemonic.startswith('mul') or mnemonic.startswith('fmul'):
+        written.update((0, 1))
+    elif args and not NO_WRITE.match(mnemonic):
+        dest = registers(args[0])
+
+        if dest:
+            written.add(dest[0])
+
+            if mnemonic in WORD_WRITE:
+                written.add(dest[0] + 1)
+            if mnemonic in WRITE_ONLY:
+                read.difference_update(written)
+
+    for arg in args: # post-increment/pre-decrement changes the pointer
+        if re.fullmatch(r'\s*([XYZ]\+|-[XYZ])\s*', arg):
+            written.update(registers(arg))
+
+    return written, read
+
+
+def check(source, listing, zero_reg=None):
+    """violations, None if the listing has no source lines"""
+    pinned = pins(source)
+    names = {reg: aliases(source, name) for reg, (name, _) in pinned.items()}
+    functions = parse_source(listing)
+    violations = []
+
+    if not any(words for code in functions.values() for _, _, _, words in code):
+        return None
+
+    for symbol, code in functions.items():
+        pushed = set()
+
+        for address, mnemonic, operands, words in code:
+            written, read = access(mnemonic, operands)
+
+            if mnemonic == 'push':
+                pushed.update(read)
+            if mnemonic == 'pop':
+                written -= pushed
+
+            for reg in sorted(written & set(pinned)):
+                if not names[reg] & words:
+                    violations.append('0x%04x %s: %s %s writes r%d (%s)' % (
+                        address, symbol, mnemonic, operands, reg, pinned[reg][0]))
+
+            if zero_reg is not None and zero_reg in read and mnemonic != 'push':
+                if zero_reg not in names or not names[zero_reg] & words:
+                    violations.append('0x%04x %s: %s %s reads r%d as zero register' % (
+                        address, symbol, mnemonic, operands, zero_reg))
+
+    return violations
+
+
+def main():
+    parser = argparse.ArgumentParser(description='register pinning checker for avr-objdump listings')
+    parser.add_argument('source', help='game source with the register bindings')
+    parser.add_argument('listing', help='avr-objdump -S listing of the game')
+    parser.add_argument('--zero-reg', help='register the compiler treats as zero (r17 for the reduced core)')
+    args = parser.parse_args()
+
+    zero_reg = int(args.zero_reg.lstrip('r')) if args.zero_reg else None
+    violations = check(open(args.source).read(), open(args.listing).read(), zero_reg)
+
+    if violations is None:
+        print('%s has no source lines (avr-objdump -S of a build with -g)' % args.listing)
+        return 2
+
+    for line in violations:
+        print(line)
+
+    return 1 if violations else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())